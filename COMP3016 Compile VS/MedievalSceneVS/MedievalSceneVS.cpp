@@ -3,9 +3,45 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <glm/gtc/packing.hpp>
 
 #include <iostream>
 #include <vector>  // For std::vector
+#include <string>
+#include <cstring> // For std::memcmp / std::memcpy
+#include <cstdio>  // For std::sscanf
+#include <cstdlib> // For std::atoi
+#include <cfloat>  // For FLT_MAX
+#include <cmath>
+#include <algorithm>
+#include <cstdint>
+#include <cctype>  // For std::tolower
+#include <fstream>
+#include <functional>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <unordered_map>
+#include <memory>
+#include <chrono>
+#include <iomanip> // For std::setprecision
+
+// Memory-mapped file access for the mesh cache
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <dirent.h>
+#endif
+#include <sys/types.h>
+#include <sys/stat.h>
 
 #include <assimp/Importer.hpp>
 #include <assimp/scene.h>
@@ -15,6 +51,543 @@
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
+#pragma region CPU Profiler
+// Scoped CPU zones (PROFILE_ZONE) recorded into per-thread buffers and exported as Chrome trace JSON, which
+// chrome://tracing and ui.perfetto.dev open. A zone reads the timestamp counter twice and stores one event in
+// its thread's own buffer, with no locks or allocation; nothing is recorded until a trace is started
+// (--trace), and building with ENABLE_PROFILER=0 compiles every zone out.
+#ifndef ENABLE_PROFILER
+#define ENABLE_PROFILER 1
+#endif
+
+#if ENABLE_PROFILER
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// Raw zone timestamp: the TSC on x86 (scaled to microseconds on export), steady_clock nanoseconds elsewhere
+inline uint64_t profilerTicks() {
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+class Profiler {
+public:
+    static const uint64_t EVENTS_PER_THREAD = 1 << 16; // Ring per thread; the oldest zones are overwritten
+
+    bool isActive() const { return active.load(std::memory_order_relaxed); }
+
+    void start() {
+        startTicks = profilerTicks();
+        startTime = std::chrono::steady_clock::now();
+        active.store(true, std::memory_order_relaxed);
+    }
+
+    // name must outlive the profiler (zones pass string literals)
+    void record(const char* name, uint64_t start, uint64_t end) {
+        ThreadBuffer& buffer = threadBuffer();
+        uint64_t index = buffer.count.load(std::memory_order_relaxed);
+        Event& event = buffer.events[index % EVENTS_PER_THREAD];
+        event.name = name;
+        event.start = start;
+        event.end = end;
+        buffer.count.store(index + 1, std::memory_order_release);
+    }
+
+    // Label the calling thread in the trace
+    void setThreadName(const std::string& name) {
+        if (isActive()) {
+            threadBuffer().name = name;
+        }
+    }
+
+    // Write every thread's zones as complete ("X") events; call once the other threads are idle
+    bool writeChromeTrace(const std::string& path) {
+        // Ticks per microsecond, measured over the whole trace
+        double elapsedUs = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - startTime).count();
+        double ticksPerUs = 1000.0;
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+        ticksPerUs = elapsedUs > 0.0 ? (double)(profilerTicks() - startTicks) / elapsedUs : 1.0;
+#endif
+
+        std::ofstream out(path, std::ios::trunc);
+        if (!out) {
+            std::cerr << "Profiler: could not write " << path << std::endl;
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        size_t eventCount = 0;
+        out << std::fixed << std::setprecision(3); // Microseconds, to the nanosecond
+        out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+        bool first = true;
+        for (const auto& buffer : buffers) {
+            out << (first ? "" : ",\n") << "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":" << buffer->id
+                << ",\"args\":{\"name\":\"" << buffer->name << "\"}}";
+            first = false;
+            uint64_t count = buffer->count.load(std::memory_order_acquire);
+            for (uint64_t i = count > EVENTS_PER_THREAD ? count - EVENTS_PER_THREAD : 0; i < count; i++) {
+                const Event& event = buffer->events[i % EVENTS_PER_THREAD];
+                out << ",\n{\"ph\":\"X\",\"name\":\"" << event.name << "\",\"pid\":1,\"tid\":" << buffer->id
+                    << ",\"ts\":" << (double)(event.start - startTicks) / ticksPerUs
+                    << ",\"dur\":" << (double)(event.end - event.start) / ticksPerUs << "}";
+                eventCount++;
+            }
+        }
+        out << "\n]}\n";
+        std::cout << "Profiler: " << eventCount << " zones from " << buffers.size() << " threads written to " << path << std::endl;
+        return true;
+    }
+
+private:
+    struct Event {
+        const char* name;
+        uint64_t start;
+        uint64_t end;
+    };
+
+    // Written only by its own thread; count publishes the events to writeChromeTrace
+    struct ThreadBuffer {
+        std::vector<Event> events;
+        std::atomic<uint64_t> count{ 0 };
+        std::string name;
+        int id = 0;
+    };
+
+    std::atomic<bool> active{ false };
+    uint64_t startTicks = 0;
+    std::chrono::steady_clock::time_point startTime;
+    std::mutex mutex; // Guards buffers; taken once per thread (on its first zone) and by the export
+    std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+
+    ThreadBuffer& threadBuffer() {
+        thread_local ThreadBuffer* buffer = nullptr;
+        if (!buffer) {
+            std::lock_guard<std::mutex> lock(mutex);
+            buffers.emplace_back(new ThreadBuffer());
+            buffer = buffers.back().get();
+            buffer->events.resize(EVENTS_PER_THREAD);
+            buffer->id = (int)buffers.size();
+            buffer->name = "thread " + std::to_string(buffer->id);
+        }
+        return *buffer;
+    }
+};
+
+Profiler profiler;
+
+// Records the time from its construction to the end of the enclosing scope
+class ProfileZone {
+public:
+    explicit ProfileZone(const char* name) : name(name), start(profiler.isActive() ? profilerTicks() : 0) {}
+    ~ProfileZone() {
+        if (start) {
+            profiler.record(name, start, profilerTicks());
+        }
+    }
+    ProfileZone(const ProfileZone&) = delete;
+    ProfileZone& operator=(const ProfileZone&) = delete;
+
+private:
+    const char* name;
+    uint64_t start;
+};
+
+#define PROFILE_ZONE_VARIABLE2(line) profileZone##line
+#define PROFILE_ZONE_VARIABLE(line) PROFILE_ZONE_VARIABLE2(line)
+#define PROFILE_ZONE(name) ProfileZone PROFILE_ZONE_VARIABLE(__LINE__)(name)
+#define PROFILE_THREAD_NAME(name) profiler.setThreadName(name)
+#else
+#define PROFILE_ZONE(name) ((void)0)
+#define PROFILE_THREAD_NAME(name) ((void)0)
+#endif
+
+// Start recording zones if a trace file was requested
+void startTrace(const std::string& path) {
+#if ENABLE_PROFILER
+    if (!path.empty()) {
+        profiler.start();
+        PROFILE_THREAD_NAME("main");
+    }
+#else
+    if (!path.empty()) {
+        std::cerr << "Profiler: built with ENABLE_PROFILER=0, no trace is written" << std::endl;
+    }
+#endif
+}
+
+// Write the trace started by startTrace (after the worker threads have stopped)
+void finishTrace(const std::string& path) {
+#if ENABLE_PROFILER
+    if (!path.empty() && profiler.isActive()) {
+        profiler.writeChromeTrace(path);
+    }
+#endif
+}
+#pragma endregion
+
+#pragma region GL Call Accounting
+// Debug-build instrumentation of the GL entry points the renderer uses for draws, binds, uniforms and uploads.
+// Each one is replaced below by a wrapper that counts the call (and the bytes it uploads, or whether it
+// rebinds what is already bound) before forwarding it. Counters cover one frame; L prints the last frame.
+// Release builds (NDEBUG) compile the layer out, so the GL calls are made directly; define GL_ACCOUNTING
+// as 0 or 1 to override. Writes through mapped buffers are not seen, only the GL calls made with them.
+#ifndef GL_ACCOUNTING
+#ifdef NDEBUG
+#define GL_ACCOUNTING 0
+#else
+#define GL_ACCOUNTING 1
+#endif
+#endif
+
+#if GL_ACCOUNTING
+enum GLCall {
+    CALL_DRAW_ARRAYS,
+    CALL_DRAW_ARRAYS_INSTANCED,
+    CALL_DRAW_ELEMENTS_BASE_VERTEX,
+    CALL_MULTI_DRAW_ELEMENTS_INDIRECT,
+    CALL_BIND_BUFFER,
+    CALL_BIND_BUFFER_RANGE,
+    CALL_BIND_BUFFER_BASE,
+    CALL_BIND_VERTEX_ARRAY,
+    CALL_BIND_TEXTURE,
+    CALL_BIND_FRAMEBUFFER,
+    CALL_USE_PROGRAM,
+    CALL_UNIFORM,
+    CALL_BUFFER_DATA,
+    CALL_BUFFER_SUB_DATA,
+    CALL_TEX_IMAGE,
+    CALL_TEX_SUB_IMAGE,
+    CALL_COMPRESSED_TEX_IMAGE,
+    CALL_COMPRESSED_TEX_SUB_IMAGE,
+    GL_CALL_COUNT
+};
+
+const char* glCallName(int call) {
+    static const char* names[GL_CALL_COUNT] = {
+        "glDrawArrays", "glDrawArraysInstanced", "glDrawElementsBaseVertex", "glMultiDrawElementsIndirect",
+        "glBindBuffer", "glBindBufferRange", "glBindBufferBase", "glBindVertexArray", "glBindTexture",
+        "glBindFramebuffer", "glUseProgram", "glUniform*", "glBufferData", "glBufferSubData",
+        "glTexImage*", "glTexSubImage*", "glCompressedTexImage*", "glCompressedTexSubImage*"
+    };
+    return names[call];
+}
+
+class GLCallAccounting {
+public:
+    struct Counters {
+        unsigned int calls[GL_CALL_COUNT] = {};
+        unsigned int redundant[GL_CALL_COUNT] = {}; // Binds of what was already bound at that point
+        unsigned int drawCommands = 0;              // Draws issued, counting each command of a multi-draw
+        uint64_t uploadBytes = 0;
+    };
+
+    void count(GLCall call) { frame.calls[call]++; }
+    void countDraws(GLCall call, unsigned int commands) { frame.calls[call]++; frame.drawCommands += commands; }
+    void countUpload(GLCall call, uint64_t bytes) { frame.calls[call]++; frame.uploadBytes += bytes; }
+
+    // Record a bind of value to a binding point; a bind identical to the last one at that point is redundant
+    void countBind(GLCall call, uint64_t slot, uint64_t value, uint64_t range = 0) {
+        frame.calls[call]++;
+        Binding& binding = bindings[slot];
+        if (binding.valid && binding.value == value && binding.range == range) {
+            frame.redundant[call]++;
+        }
+        binding.valid = true;
+        binding.value = value;
+        binding.range = range;
+    }
+
+    // Forget a binding point whose contents changed behind our back (element buffer on VAO change)
+    void forgetSlot(uint64_t slot) { bindings.erase(slot); }
+
+    // Forget every binding of a deleted object; GL unbinds it, so its name may come back bound to something new
+    void forgetObject(uint64_t kind, GLuint name) {
+        for (auto it = bindings.begin(); it != bindings.end();) {
+            if ((it->first >> 56) == kind && it->second.value == name) it = bindings.erase(it);
+            else ++it;
+        }
+    }
+
+    void endFrame() {
+        last = frame;
+        frame = Counters();
+    }
+
+    void printSummary() const {
+        unsigned int draws = 0, binds = 0, redundant = 0;
+        for (int call = CALL_DRAW_ARRAYS; call <= CALL_MULTI_DRAW_ELEMENTS_INDIRECT; call++) draws += last.calls[call];
+        for (int call = CALL_BIND_BUFFER; call <= CALL_USE_PROGRAM; call++) {
+            binds += last.calls[call];
+            redundant += last.redundant[call];
+        }
+        std::cout << "GL calls: " << draws << " draw calls (" << last.drawCommands << " draws), " << binds << " binds ("
+            << redundant << " redundant), " << last.calls[CALL_UNIFORM] << " uniform calls, " << last.uploadBytes / 1024 << " KB uploaded" << std::endl;
+        for (int call = 0; call < GL_CALL_COUNT; call++) {
+            if (last.calls[call] == 0) continue;
+            std::cout << "  " << glCallName(call) << ": " << last.calls[call];
+            if (last.redundant[call] > 0) std::cout << " (" << last.redundant[call] << " redundant)";
+            std::cout << std::endl;
+        }
+    }
+
+    // Binding point keys: object kind in the top byte, then the target and indexed slot
+    static uint64_t slotKey(uint64_t kind, GLenum target, GLuint index = 0) {
+        return (kind << 56) | ((uint64_t)target << 24) | index;
+    }
+
+    enum ObjectKind : uint64_t { KIND_BUFFER = 1, KIND_BUFFER_RANGE, KIND_VERTEX_ARRAY, KIND_TEXTURE, KIND_FRAMEBUFFER, KIND_PROGRAM };
+
+private:
+    struct Binding {
+        bool valid = false;
+        uint64_t value = 0;
+        uint64_t range = 0;
+    };
+
+    Counters frame;
+    Counters last;
+    std::unordered_map<uint64_t, Binding> bindings;
+};
+
+GLCallAccounting glAccounting;
+
+// Bytes in one pixel of an uncompressed client image
+inline uint64_t glPixelBytes(GLenum format, GLenum type) {
+    uint64_t components = format == GL_RED ? 1 : format == GL_RG ? 2 : format == GL_RGB || format == GL_BGR ? 3 : 4;
+    uint64_t size = type == GL_UNSIGNED_BYTE || type == GL_BYTE ? 1 : type == GL_FLOAT || type == GL_INT || type == GL_UNSIGNED_INT ? 4 : 2;
+    return components * size;
+}
+
+// Wrappers; the GL names they call still mean the real entry points here, the macros below redirect the rest of the file
+inline void accountedDrawArrays(GLenum mode, GLint first, GLsizei count) {
+    glAccounting.countDraws(CALL_DRAW_ARRAYS, 1);
+    glDrawArrays(mode, first, count);
+}
+inline void accountedDrawArraysInstanced(GLenum mode, GLint first, GLsizei count, GLsizei instanceCount) {
+    glAccounting.countDraws(CALL_DRAW_ARRAYS_INSTANCED, 1);
+    glDrawArraysInstanced(mode, first, count, instanceCount);
+}
+inline void accountedDrawElementsBaseVertex(GLenum mode, GLsizei count, GLenum type, const void* indices, GLint baseVertex) {
+    glAccounting.countDraws(CALL_DRAW_ELEMENTS_BASE_VERTEX, 1);
+    glDrawElementsBaseVertex(mode, count, type, indices, baseVertex);
+}
+inline void accountedMultiDrawElementsIndirect(GLenum mode, GLenum type, const void* indirect, GLsizei drawCount, GLsizei stride) {
+    glAccounting.countDraws(CALL_MULTI_DRAW_ELEMENTS_INDIRECT, (unsigned int)drawCount);
+    glMultiDrawElementsIndirect(mode, type, indirect, drawCount, stride);
+}
+inline void accountedBindBuffer(GLenum target, GLuint buffer) {
+    glAccounting.countBind(CALL_BIND_BUFFER, GLCallAccounting::slotKey(GLCallAccounting::KIND_BUFFER, target), buffer);
+    glBindBuffer(target, buffer);
+}
+inline void accountedBindBufferRange(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size) {
+    glAccounting.countBind(CALL_BIND_BUFFER_RANGE, GLCallAccounting::slotKey(GLCallAccounting::KIND_BUFFER_RANGE, target, index), buffer,
+        ((uint64_t)offset << 32) ^ (uint64_t)size);
+    glAccounting.forgetSlot(GLCallAccounting::slotKey(GLCallAccounting::KIND_BUFFER, target)); // Also sets the generic binding
+    glBindBufferRange(target, index, buffer, offset, size);
+}
+inline void accountedBindBufferBase(GLenum target, GLuint index, GLuint buffer) {
+    glAccounting.countBind(CALL_BIND_BUFFER_BASE, GLCallAccounting::slotKey(GLCallAccounting::KIND_BUFFER_RANGE, target, index), buffer, ~0ull);
+    glAccounting.forgetSlot(GLCallAccounting::slotKey(GLCallAccounting::KIND_BUFFER, target));
+    glBindBufferBase(target, index, buffer);
+}
+inline void accountedBindVertexArray(GLuint array) {
+    glAccounting.countBind(CALL_BIND_VERTEX_ARRAY, GLCallAccounting::slotKey(GLCallAccounting::KIND_VERTEX_ARRAY, 0), array);
+    glAccounting.forgetSlot(GLCallAccounting::slotKey(GLCallAccounting::KIND_BUFFER, GL_ELEMENT_ARRAY_BUFFER)); // Part of VAO state
+    glBindVertexArray(array);
+}
+inline void accountedBindTexture(GLenum target, GLuint texture) {
+    glAccounting.countBind(CALL_BIND_TEXTURE, GLCallAccounting::slotKey(GLCallAccounting::KIND_TEXTURE, target), texture);
+    glBindTexture(target, texture);
+}
+inline void accountedBindFramebuffer(GLenum target, GLuint framebuffer) {
+    glAccounting.countBind(CALL_BIND_FRAMEBUFFER, GLCallAccounting::slotKey(GLCallAccounting::KIND_FRAMEBUFFER, target), framebuffer);
+    glBindFramebuffer(target, framebuffer);
+}
+inline void accountedUseProgram(GLuint program) {
+    glAccounting.countBind(CALL_USE_PROGRAM, GLCallAccounting::slotKey(GLCallAccounting::KIND_PROGRAM, 0), program);
+    glUseProgram(program);
+}
+inline void accountedUniform1i(GLint location, GLint v0) {
+    glAccounting.count(CALL_UNIFORM);
+    glUniform1i(location, v0);
+}
+inline void accountedUniform1f(GLint location, GLfloat v0) {
+    glAccounting.count(CALL_UNIFORM);
+    glUniform1f(location, v0);
+}
+inline void accountedUniform3fv(GLint location, GLsizei count, const GLfloat* value) {
+    glAccounting.count(CALL_UNIFORM);
+    glUniform3fv(location, count, value);
+}
+inline void accountedUniform4fv(GLint location, GLsizei count, const GLfloat* value) {
+    glAccounting.count(CALL_UNIFORM);
+    glUniform4fv(location, count, value);
+}
+inline void accountedUniformMatrix4fv(GLint location, GLsizei count, GLboolean transpose, const GLfloat* value) {
+    glAccounting.count(CALL_UNIFORM);
+    glUniformMatrix4fv(location, count, transpose, value);
+}
+inline void accountedBufferData(GLenum target, GLsizeiptr size, const void* data, GLenum usage) {
+    glAccounting.countUpload(CALL_BUFFER_DATA, data ? (uint64_t)size : 0); // Allocation only without data
+    glBufferData(target, size, data, usage);
+}
+inline void accountedBufferSubData(GLenum target, GLintptr offset, GLsizeiptr size, const void* data) {
+    glAccounting.countUpload(CALL_BUFFER_SUB_DATA, (uint64_t)size);
+    glBufferSubData(target, offset, size, data);
+}
+// Texture uploads count their pixels whether they come from client memory or a bound unpack buffer
+inline void accountedTexImage2D(GLenum target, GLint level, GLint internalFormat, GLsizei width, GLsizei height, GLint border,
+    GLenum format, GLenum type, const void* pixels) {
+    glAccounting.countUpload(CALL_TEX_IMAGE, pixels ? (uint64_t)width * height * glPixelBytes(format, type) : 0);
+    glTexImage2D(target, level, internalFormat, width, height, border, format, type, pixels);
+}
+inline void accountedTexImage3D(GLenum target, GLint level, GLint internalFormat, GLsizei width, GLsizei height, GLsizei depth, GLint border,
+    GLenum format, GLenum type, const void* pixels) {
+    glAccounting.countUpload(CALL_TEX_IMAGE, pixels ? (uint64_t)width * height * depth * glPixelBytes(format, type) : 0);
+    glTexImage3D(target, level, internalFormat, width, height, depth, border, format, type, pixels);
+}
+inline void accountedTexSubImage2D(GLenum target, GLint level, GLint xoffset, GLint yoffset, GLsizei width, GLsizei height,
+    GLenum format, GLenum type, const void* pixels) {
+    glAccounting.countUpload(CALL_TEX_SUB_IMAGE, (uint64_t)width * height * glPixelBytes(format, type));
+    glTexSubImage2D(target, level, xoffset, yoffset, width, height, format, type, pixels);
+}
+inline void accountedTexSubImage3D(GLenum target, GLint level, GLint xoffset, GLint yoffset, GLint zoffset, GLsizei width, GLsizei height,
+    GLsizei depth, GLenum format, GLenum type, const void* pixels) {
+    glAccounting.countUpload(CALL_TEX_SUB_IMAGE, (uint64_t)width * height * depth * glPixelBytes(format, type));
+    glTexSubImage3D(target, level, xoffset, yoffset, zoffset, width, height, depth, format, type, pixels);
+}
+inline void accountedCompressedTexImage2D(GLenum target, GLint level, GLenum internalFormat, GLsizei width, GLsizei height, GLint border,
+    GLsizei imageSize, const void* data) {
+    glAccounting.countUpload(CALL_COMPRESSED_TEX_IMAGE, data ? (uint64_t)imageSize : 0);
+    glCompressedTexImage2D(target, level, internalFormat, width, height, border, imageSize, data);
+}
+inline void accountedCompressedTexImage3D(GLenum target, GLint level, GLenum internalFormat, GLsizei width, GLsizei height, GLsizei depth,
+    GLint border, GLsizei imageSize, const void* data) {
+    glAccounting.countUpload(CALL_COMPRESSED_TEX_IMAGE, data ? (uint64_t)imageSize : 0);
+    glCompressedTexImage3D(target, level, internalFormat, width, height, depth, border, imageSize, data);
+}
+inline void accountedCompressedTexSubImage2D(GLenum target, GLint level, GLint xoffset, GLint yoffset, GLsizei width, GLsizei height,
+    GLenum format, GLsizei imageSize, const void* data) {
+    glAccounting.countUpload(CALL_COMPRESSED_TEX_SUB_IMAGE, (uint64_t)imageSize);
+    glCompressedTexSubImage2D(target, level, xoffset, yoffset, width, height, format, imageSize, data);
+}
+inline void accountedCompressedTexSubImage3D(GLenum target, GLint level, GLint xoffset, GLint yoffset, GLint zoffset, GLsizei width,
+    GLsizei height, GLsizei depth, GLenum format, GLsizei imageSize, const void* data) {
+    glAccounting.countUpload(CALL_COMPRESSED_TEX_SUB_IMAGE, (uint64_t)imageSize);
+    glCompressedTexSubImage3D(target, level, xoffset, yoffset, zoffset, width, height, depth, format, imageSize, data);
+}
+// Deleting a bound object unbinds it, so its bindings are forgotten
+inline void accountedDeleteBuffers(GLsizei n, const GLuint* buffers) {
+    for (GLsizei i = 0; i < n; i++) {
+        glAccounting.forgetObject(GLCallAccounting::KIND_BUFFER, buffers[i]);
+        glAccounting.forgetObject(GLCallAccounting::KIND_BUFFER_RANGE, buffers[i]);
+    }
+    glDeleteBuffers(n, buffers);
+}
+inline void accountedDeleteVertexArrays(GLsizei n, const GLuint* arrays) {
+    for (GLsizei i = 0; i < n; i++) glAccounting.forgetObject(GLCallAccounting::KIND_VERTEX_ARRAY, arrays[i]);
+    glDeleteVertexArrays(n, arrays);
+}
+inline void accountedDeleteTextures(GLsizei n, const GLuint* textures) {
+    for (GLsizei i = 0; i < n; i++) glAccounting.forgetObject(GLCallAccounting::KIND_TEXTURE, textures[i]);
+    glDeleteTextures(n, textures);
+}
+inline void accountedDeleteFramebuffers(GLsizei n, const GLuint* framebuffers) {
+    for (GLsizei i = 0; i < n; i++) glAccounting.forgetObject(GLCallAccounting::KIND_FRAMEBUFFER, framebuffers[i]);
+    glDeleteFramebuffers(n, framebuffers);
+}
+inline void accountedDeleteProgram(GLuint program) {
+    glAccounting.forgetObject(GLCallAccounting::KIND_PROGRAM, program);
+    glDeleteProgram(program);
+}
+
+// GLEW defines most entry points as macros; undefine them and route every later call through the wrappers
+#undef glDrawArrays
+#undef glDrawArraysInstanced
+#undef glDrawElementsBaseVertex
+#undef glMultiDrawElementsIndirect
+#undef glBindBuffer
+#undef glBindBufferRange
+#undef glBindBufferBase
+#undef glBindVertexArray
+#undef glBindTexture
+#undef glBindFramebuffer
+#undef glUseProgram
+#undef glUniform1i
+#undef glUniform1f
+#undef glUniform3fv
+#undef glUniform4fv
+#undef glUniformMatrix4fv
+#undef glBufferData
+#undef glBufferSubData
+#undef glTexImage2D
+#undef glTexImage3D
+#undef glTexSubImage2D
+#undef glTexSubImage3D
+#undef glCompressedTexImage2D
+#undef glCompressedTexImage3D
+#undef glCompressedTexSubImage2D
+#undef glCompressedTexSubImage3D
+#undef glDeleteBuffers
+#undef glDeleteVertexArrays
+#undef glDeleteTextures
+#undef glDeleteFramebuffers
+#undef glDeleteProgram
+#define glDrawArrays(...) accountedDrawArrays(__VA_ARGS__)
+#define glDrawArraysInstanced(...) accountedDrawArraysInstanced(__VA_ARGS__)
+#define glDrawElementsBaseVertex(...) accountedDrawElementsBaseVertex(__VA_ARGS__)
+#define glMultiDrawElementsIndirect(...) accountedMultiDrawElementsIndirect(__VA_ARGS__)
+#define glBindBuffer(...) accountedBindBuffer(__VA_ARGS__)
+#define glBindBufferRange(...) accountedBindBufferRange(__VA_ARGS__)
+#define glBindBufferBase(...) accountedBindBufferBase(__VA_ARGS__)
+#define glBindVertexArray(...) accountedBindVertexArray(__VA_ARGS__)
+#define glBindTexture(...) accountedBindTexture(__VA_ARGS__)
+#define glBindFramebuffer(...) accountedBindFramebuffer(__VA_ARGS__)
+#define glUseProgram(...) accountedUseProgram(__VA_ARGS__)
+#define glUniform1i(...) accountedUniform1i(__VA_ARGS__)
+#define glUniform1f(...) accountedUniform1f(__VA_ARGS__)
+#define glUniform3fv(...) accountedUniform3fv(__VA_ARGS__)
+#define glUniform4fv(...) accountedUniform4fv(__VA_ARGS__)
+#define glUniformMatrix4fv(...) accountedUniformMatrix4fv(__VA_ARGS__)
+#define glBufferData(...) accountedBufferData(__VA_ARGS__)
+#define glBufferSubData(...) accountedBufferSubData(__VA_ARGS__)
+#define glTexImage2D(...) accountedTexImage2D(__VA_ARGS__)
+#define glTexImage3D(...) accountedTexImage3D(__VA_ARGS__)
+#define glTexSubImage2D(...) accountedTexSubImage2D(__VA_ARGS__)
+#define glTexSubImage3D(...) accountedTexSubImage3D(__VA_ARGS__)
+#define glCompressedTexImage2D(...) accountedCompressedTexImage2D(__VA_ARGS__)
+#define glCompressedTexImage3D(...) accountedCompressedTexImage3D(__VA_ARGS__)
+#define glCompressedTexSubImage2D(...) accountedCompressedTexSubImage2D(__VA_ARGS__)
+#define glCompressedTexSubImage3D(...) accountedCompressedTexSubImage3D(__VA_ARGS__)
+#define glDeleteBuffers(...) accountedDeleteBuffers(__VA_ARGS__)
+#define glDeleteVertexArrays(...) accountedDeleteVertexArrays(__VA_ARGS__)
+#define glDeleteTextures(...) accountedDeleteTextures(__VA_ARGS__)
+#define glDeleteFramebuffers(...) accountedDeleteFramebuffers(__VA_ARGS__)
+#define glDeleteProgram(...) accountedDeleteProgram(__VA_ARGS__)
+#endif
+
+// Close the accounting frame (call once per frame, after presenting)
+inline void endGLAccountingFrame() {
+#if GL_ACCOUNTING
+    glAccounting.endFrame();
+#endif
+}
+
+// Print the last frame's GL call counts
+void printGLAccounting() {
+#if GL_ACCOUNTING
+    glAccounting.printSummary();
+#else
+    std::cout << "GL calls: accounting is compiled out of release builds (define GL_ACCOUNTING=1)" << std::endl;
+#endif
+}
+#pragma endregion
+
 // House and Castle model load
 #pragma region Model Loading
 
@@ -25,72 +598,134 @@ struct Vertex {
     glm::vec2 TexCoords;
 };
 
-// Mesh class to handle rendering
+// Axis-aligned bounding box (starts empty: min > max until a point is added)
+struct AABB {
+    glm::vec3 min = glm::vec3(FLT_MAX);
+    glm::vec3 max = glm::vec3(-FLT_MAX);
+
+    bool isEmpty() const { return min.x > max.x; }
+
+    void expand(const glm::vec3& point) {
+        min = glm::min(min, point);
+        max = glm::max(max, point);
+    }
+    void expand(const AABB& other) {
+        if (other.isEmpty()) return;
+        expand(other.min);
+        expand(other.max);
+    }
+};
+
+// Transform a local-space box by a model matrix and return the box enclosing the result (Arvo's method)
+AABB transformAABB(const AABB& box, const glm::mat4& model) {
+    AABB result;
+    if (box.isEmpty()) {
+        return result;
+    }
+    glm::vec3 center = (box.min + box.max) * 0.5f;
+    glm::vec3 extent = (box.max - box.min) * 0.5f;
+
+    glm::vec3 newCenter = glm::vec3(model * glm::vec4(center, 1.0f));
+    glm::vec3 newExtent;
+    for (int i = 0; i < 3; i++) {
+        newExtent[i] = std::abs(model[0][i]) * extent.x + std::abs(model[1][i]) * extent.y + std::abs(model[2][i]) * extent.z;
+    }
+    result.min = newCenter - newExtent;
+    result.max = newCenter + newExtent;
+    return result;
+}
+
+// Mesh class holding one imported mesh: its geometry, diffuse texture and bounds.
+// The geometry is uploaded as part of the static batch, which packs every model into shared buffers;
+// after that the CPU copy can be released (bounds and material stay).
 class Mesh {
 public:
-    Mesh(std::vector<Vertex> vertices, std::vector<unsigned int> indices, unsigned int textureID)
-        : vertices(vertices), indices(indices), textureID(textureID) {
-        setupMesh();
+    // Takes ownership of the arrays (pass them with std::move to avoid copying)
+    Mesh(std::vector<Vertex> vertices, std::vector<unsigned int> indices, int materialID, const AABB& bounds)
+        : vertices(std::move(vertices)), indices(std::move(indices)), materialID(materialID), bounds(bounds) {
     }
-    void draw() {
-        glBindTexture(GL_TEXTURE_2D, textureID);
-        glBindVertexArray(VAO);
-        glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
-        glBindVertexArray(0);
+    const AABB& getBounds() const { return bounds; }
+    const std::vector<Vertex>& getVertices() const { return vertices; }
+    const std::vector<unsigned int>& getIndices() const { return indices; }
+    int getMaterialID() const { return materialID; } // Texture library id, -1 if the mesh has no diffuse map
+
+    // Free the vertex and index arrays once they live on the GPU
+    void releaseGeometry() {
+        std::vector<Vertex>().swap(vertices);
+        std::vector<unsigned int>().swap(indices);
+    }
+
+    // CPU memory held by this mesh's arrays
+    size_t residentBytes() const {
+        return vertices.capacity() * sizeof(Vertex) + indices.capacity() * sizeof(unsigned int);
     }
 private:
     std::vector<Vertex> vertices;
     std::vector<unsigned int> indices;
-    unsigned int VAO, VBO, EBO;
-    unsigned int textureID;
-
-    void setupMesh() {
-        glGenVertexArrays(1, &VAO);
-        glGenBuffers(1, &VBO);
-        glGenBuffers(1, &EBO);
+    int materialID;
+    AABB bounds; // Local-space bounds of the vertices
+};
+// Function prototypes
+void processNode(aiNode* node, const aiScene* scene, std::vector<Mesh>& meshes, const std::string& directory);
+void processMesh(aiMesh* mesh, const aiScene* scene, const std::string& directory, std::vector<Mesh>& meshes);
+int loadTexture(const char* path);
+void optimizeMesh(std::vector<Vertex>& vertices, std::vector<unsigned int>& indices);
+bool loadObj(const std::string& path, std::vector<Mesh>& meshes);
+
+// Which importer parses .obj models when there is no valid mesh cache
+enum ModelLoader {
+    MODEL_LOADER_OBJ,       // The dedicated parallel OBJ/MTL reader (loadObj)
+    MODEL_LOADER_ASSIMP     // Assimp's general importer
+};
 
-        glBindVertexArray(VAO);
-        glBindBuffer(GL_ARRAY_BUFFER, VBO);
-        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);
+ModelLoader modelLoader = MODEL_LOADER_OBJ;
 
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
+bool readMeshCache(const std::string& modelPath, ModelLoader loader, std::vector<Mesh>& meshes);
+void writeMeshCache(const std::string& modelPath, ModelLoader loader, const std::vector<Mesh>& meshes, size_t firstMesh);
 
-        // Position attribute
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
-        glEnableVertexAttribArray(0);
+bool importWithAssimp(const std::string& path, std::vector<Mesh>& meshes);
 
-        // Texture coord attribute
-        glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
-        glEnableVertexAttribArray(1);
+// Load Model from its binary cache, or parse it (then write the cache for the next start). A cache only
+// serves the importer that wrote it, so switching --model-loader re-imports.
+void loadModel(const std::string& path, std::vector<Mesh>& meshes) {
+    PROFILE_ZONE("loadModel");
+    bool isObj = path.size() > 4 && path.compare(path.size() - 4, 4, ".obj") == 0;
+    ModelLoader loader = isObj ? modelLoader : MODEL_LOADER_ASSIMP;
+    if (readMeshCache(path, loader, meshes)) {
+        return;
+    }
 
-        glBindVertexArray(0);
+    size_t firstMesh = meshes.size();
+    bool loaded = loader == MODEL_LOADER_OBJ && loadObj(path, meshes);
+    if (!loaded && !importWithAssimp(path, meshes)) {
+        return;
     }
-};
-// Function prototypes
-void processNode(aiNode* node, const aiScene* scene, std::vector<Mesh>& meshes, const std::string& directory);
-Mesh processMesh(aiMesh* mesh, const aiScene* scene, const std::string& directory);
-GLuint loadTexture(const char* path);
+    // Record the importer that actually ran (Assimp when the OBJ reader fell back to it)
+    writeMeshCache(path, loaded ? MODEL_LOADER_OBJ : MODEL_LOADER_ASSIMP, meshes, firstMesh);
+}
 
-// Load Model using Assimp
-void loadModel(const std::string& path, std::vector<Mesh>& meshes) {
+// Import any format Assimp supports, appending the meshes
+bool importWithAssimp(const std::string& path, std::vector<Mesh>& meshes) {
+    PROFILE_ZONE("importWithAssimp");
     Assimp::Importer importer;
     const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_CalcTangentSpace);
 
     if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) {
         std::cerr << "Assimp error: " << importer.GetErrorString() << std::endl;
-        return;
+        return false;
     }
     std::string directory = path.substr(0, path.find_last_of('/'));
 
     // Correctly pass meshes as a reference to processNode
     processNode(scene->mRootNode, scene, meshes, directory);
+    return true;
 }
 
 void processNode(aiNode* node, const aiScene* scene, std::vector<Mesh>& meshes, const std::string& directory) {
+    PROFILE_ZONE("processNode");
     for (unsigned int i = 0; i < node->mNumMeshes; i++) {
         aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
-        meshes.push_back(processMesh(mesh, scene, directory));
+        processMesh(mesh, scene, directory, meshes);
     }
 
     for (unsigned int i = 0; i < node->mNumChildren; i++) {
@@ -98,14 +733,21 @@ void processNode(aiNode* node, const aiScene* scene, std::vector<Mesh>& meshes,
     }
 }
 
-Mesh processMesh(aiMesh* mesh, const aiScene* scene, const std::string& directory) {
+// Convert one Assimp mesh and construct it in place at the end of meshes (its arrays are moved, not copied)
+void processMesh(aiMesh* mesh, const aiScene* scene, const std::string& directory, std::vector<Mesh>& meshes) {
+    PROFILE_ZONE("processMesh");
     std::vector<Vertex> vertices;
     std::vector<unsigned int> indices;
-    unsigned int textureID = 0;
+    int materialID = -1;
+    AABB bounds;
+    vertices.reserve(mesh->mNumVertices);
+    indices.reserve(mesh->mNumFaces * 3);
 
     for (unsigned int i = 0; i < mesh->mNumVertices; i++) {
         Vertex vertex;
         vertex.Position = glm::vec3(mesh->mVertices[i].x, mesh->mVertices[i].y, mesh->mVertices[i].z);
+        bounds.expand(vertex.Position);
+        vertex.Normal = mesh->HasNormals() ? glm::vec3(mesh->mNormals[i].x, mesh->mNormals[i].y, mesh->mNormals[i].z) : glm::vec3(0.0f);
 
         if (mesh->mTextureCoords[0]) {
             vertex.TexCoords = glm::vec2(mesh->mTextureCoords[0][i].x, mesh->mTextureCoords[0][i].y);
@@ -124,6 +766,9 @@ Mesh processMesh(aiMesh* mesh, const aiScene* scene, const std::string& director
         }
     }
 
+    // Reorder for the vertex cache, overdraw and vertex fetch (the cache stores the optimized result)
+    optimizeMesh(vertices, indices);
+
     // Process materials
     if (mesh->mMaterialIndex >= 0) {
         aiMaterial* material = scene->mMaterials[mesh->mMaterialIndex];
@@ -131,14 +776,292 @@ Mesh processMesh(aiMesh* mesh, const aiScene* scene, const std::string& director
         aiString texturePath;
         if (material->GetTexture(aiTextureType_DIFFUSE, 0, &texturePath) == AI_SUCCESS) {
             std::string fullPath = directory + "/" + texturePath.C_Str();
-            textureID = loadTexture(fullPath.c_str());
+            materialID = loadTexture(fullPath.c_str());
+        }
+    }
+
+    meshes.emplace_back(std::move(vertices), std::move(indices), materialID, bounds);
+}
+
+// CPU memory held by a model's meshes (arrays plus the Mesh objects themselves)
+size_t residentBytes(const std::vector<Mesh>& meshes) {
+    size_t bytes = meshes.capacity() * sizeof(Mesh);
+    for (const auto& mesh : meshes) {
+        bytes += mesh.residentBytes();
+    }
+    return bytes;
+}
+
+// Bounds of a whole model (union of its meshes)
+AABB computeModelBounds(const std::vector<Mesh>& meshes) {
+    AABB bounds;
+    for (const auto& mesh : meshes) {
+        bounds.expand(mesh.getBounds());
+    }
+    return bounds;
+}
+
+
+#pragma endregion
+#pragma region Mesh Optimization
+// Import-time index and vertex reordering for the GPU:
+//  1. triangles reordered for the post-transform vertex cache (Forsyth's linear-speed algorithm),
+//  2. the result cut into clusters where the cache restarts, and the clusters sorted so outward-facing
+//     ones come first (they tend to occlude the rest, reducing overdraw),
+//  3. vertices renumbered in order of first use so vertex fetch walks the buffer forwards.
+// ACMR (cache misses per triangle) and ATVR (cache misses per vertex, 1.0 is ideal) are measured with a
+// simulated 16-entry FIFO cache before and after.
+const int FORSYTH_CACHE_SIZE = 32;
+const int SIMULATED_CACHE_SIZE = 16;
+
+struct VertexCacheStats {
+    float acmr;
+    float atvr;
+};
+
+VertexCacheStats measureVertexCache(const std::vector<unsigned int>& indices, size_t vertexCount) {
+    // A vertex is in the FIFO if fewer than SIMULATED_CACHE_SIZE misses happened since it was loaded
+    std::vector<unsigned int> loadedAt(vertexCount, 0);
+    unsigned int time = SIMULATED_CACHE_SIZE + 1;
+    unsigned int misses = 0;
+    std::vector<char> used(vertexCount, 0);
+    size_t usedCount = 0;
+    for (unsigned int index : indices) {
+        if (time - loadedAt[index] > (unsigned int)SIMULATED_CACHE_SIZE) {
+            loadedAt[index] = time++;
+            misses++;
+        }
+        if (!used[index]) {
+            used[index] = 1;
+            usedCount++;
+        }
+    }
+    VertexCacheStats stats;
+    stats.acmr = indices.empty() ? 0.0f : (float)misses / (float)(indices.size() / 3);
+    stats.atvr = usedCount == 0 ? 0.0f : (float)misses / (float)usedCount;
+    return stats;
+}
+
+float forsythVertexScore(int cachePosition, unsigned int remainingTriangles) {
+    if (remainingTriangles == 0) {
+        return -1.0f; // Nothing left to draw with this vertex
+    }
+    float score = 0.0f;
+    if (cachePosition >= 0) {
+        if (cachePosition < 3) {
+            score = 0.75f; // Used by the last triangle: fixed score so it is not favoured too strongly
+        }
+        else {
+            float scale = 1.0f / (FORSYTH_CACHE_SIZE - 3);
+            score = std::pow(1.0f - (cachePosition - 3) * scale, 1.5f);
+        }
+    }
+    // Bonus for vertices with few triangles left, so they get finished off instead of left lonely
+    return score + 2.0f * std::pow((float)remainingTriangles, -0.5f);
+}
+
+std::vector<unsigned int> optimizeVertexCache(const std::vector<unsigned int>& indices, size_t vertexCount) {
+    size_t triangleCount = indices.size() / 3;
+
+    // Triangle adjacency per vertex
+    std::vector<unsigned int> remaining(vertexCount, 0);
+    for (unsigned int index : indices) {
+        remaining[index]++;
+    }
+    std::vector<unsigned int> firstTriangle(vertexCount + 1, 0);
+    for (size_t v = 0; v < vertexCount; v++) {
+        firstTriangle[v + 1] = firstTriangle[v] + remaining[v];
+    }
+    std::vector<unsigned int> adjacency(indices.size());
+    std::vector<unsigned int> fill(firstTriangle.begin(), firstTriangle.end() - 1);
+    for (size_t t = 0; t < triangleCount; t++) {
+        for (int k = 0; k < 3; k++) {
+            adjacency[fill[indices[t * 3 + k]]++] = (unsigned int)t;
+        }
+    }
+
+    std::vector<int> cachePosition(vertexCount, -1);
+    std::vector<float> vertexScore(vertexCount);
+    for (size_t v = 0; v < vertexCount; v++) {
+        vertexScore[v] = forsythVertexScore(-1, remaining[v]);
+    }
+    std::vector<float> triangleScore(triangleCount);
+    for (size_t t = 0; t < triangleCount; t++) {
+        triangleScore[t] = vertexScore[indices[t * 3]] + vertexScore[indices[t * 3 + 1]] + vertexScore[indices[t * 3 + 2]];
+    }
+
+    std::vector<char> emitted(triangleCount, 0);
+    std::vector<unsigned int> cache;
+    std::vector<unsigned int> result;
+    result.reserve(indices.size());
+    size_t scanCursor = 0;
+    int bestTriangle = -1;
+
+    for (size_t emittedCount = 0; emittedCount < triangleCount; emittedCount++) {
+        if (bestTriangle < 0) {
+            // No candidate next to the cache: take the next triangle not drawn yet
+            while (emitted[scanCursor]) scanCursor++;
+            bestTriangle = (int)scanCursor;
+        }
+
+        // Emit it and move its vertices to the front of the LRU cache
+        emitted[bestTriangle] = 1;
+        std::vector<unsigned int> newCache;
+        newCache.reserve(FORSYTH_CACHE_SIZE + 3);
+        for (int k = 0; k < 3; k++) {
+            unsigned int v = indices[bestTriangle * 3 + k];
+            result.push_back(v);
+            newCache.push_back(v);
+            remaining[v]--;
+            // Drop the emitted triangle from the vertex's adjacency list
+            unsigned int* begin = &adjacency[firstTriangle[v]];
+            unsigned int* end = begin + remaining[v] + 1;
+            *std::find(begin, end, (unsigned int)bestTriangle) = *(end - 1);
+        }
+        for (unsigned int v : cache) {
+            if (v != newCache[0] && v != newCache[1] && v != newCache[2]) {
+                newCache.push_back(v);
+            }
         }
+
+        // Rescore vertices whose cache position changed (including the ones pushed out) and their triangles
+        for (size_t i = 0; i < newCache.size(); i++) {
+            unsigned int v = newCache[i];
+            cachePosition[v] = i < (size_t)FORSYTH_CACHE_SIZE ? (int)i : -1;
+            float score = forsythVertexScore(cachePosition[v], remaining[v]);
+            float delta = score - vertexScore[v];
+            vertexScore[v] = score;
+            for (unsigned int a = firstTriangle[v]; a < firstTriangle[v] + remaining[v]; a++) {
+                triangleScore[adjacency[a]] += delta;
+            }
+        }
+        if (newCache.size() > (size_t)FORSYTH_CACHE_SIZE) {
+            newCache.resize(FORSYTH_CACHE_SIZE);
+        }
+        cache.swap(newCache);
+
+        // Next candidate: the best-scoring undrawn triangle using a cached vertex
+        bestTriangle = -1;
+        float bestScore = -FLT_MAX;
+        for (unsigned int v : cache) {
+            for (unsigned int a = firstTriangle[v]; a < firstTriangle[v] + remaining[v]; a++) {
+                unsigned int t = adjacency[a];
+                if (triangleScore[t] > bestScore) {
+                    bestScore = triangleScore[t];
+                    bestTriangle = (int)t;
+                }
+            }
+        }
+    }
+    return result;
+}
+
+// Reorder clusters of the cache-optimized triangle list so outward-facing clusters are drawn first.
+// A cluster starts wherever all three vertices of a triangle miss the simulated cache, so reordering
+// whole clusters leaves the cache behaviour inside each one intact.
+std::vector<unsigned int> optimizeOverdraw(const std::vector<unsigned int>& indices, const std::vector<Vertex>& vertices) {
+    size_t triangleCount = indices.size() / 3;
+    std::vector<size_t> clusterStarts;
+    std::vector<unsigned int> loadedAt(vertices.size(), 0);
+    unsigned int time = SIMULATED_CACHE_SIZE + 1;
+    for (size_t t = 0; t < triangleCount; t++) {
+        int misses = 0;
+        for (int k = 0; k < 3; k++) {
+            unsigned int v = indices[t * 3 + k];
+            if (time - loadedAt[v] > (unsigned int)SIMULATED_CACHE_SIZE) {
+                loadedAt[v] = time++;
+                misses++;
+            }
+        }
+        if (t == 0 || misses == 3) {
+            clusterStarts.push_back(t);
+        }
+    }
+    clusterStarts.push_back(triangleCount);
+
+    // Area-weighted centroid and normal per cluster, and for the whole mesh
+    struct Cluster {
+        size_t first, count;
+        glm::vec3 centroid;
+        glm::vec3 normal;
+        float sortKey;
+    };
+    std::vector<Cluster> clusters;
+    glm::vec3 meshCentroid(0.0f);
+    float meshArea = 0.0f;
+    for (size_t c = 0; c + 1 < clusterStarts.size(); c++) {
+        Cluster cluster;
+        cluster.first = clusterStarts[c];
+        cluster.count = clusterStarts[c + 1] - clusterStarts[c];
+        cluster.centroid = glm::vec3(0.0f);
+        cluster.normal = glm::vec3(0.0f);
+        float area = 0.0f;
+        for (size_t t = cluster.first; t < cluster.first + cluster.count; t++) {
+            const glm::vec3& p0 = vertices[indices[t * 3]].Position;
+            const glm::vec3& p1 = vertices[indices[t * 3 + 1]].Position;
+            const glm::vec3& p2 = vertices[indices[t * 3 + 2]].Position;
+            glm::vec3 cross = glm::cross(p1 - p0, p2 - p0); // Length is twice the area
+            float triangleArea = glm::length(cross);
+            cluster.centroid += (p0 + p1 + p2) * (triangleArea / 3.0f);
+            cluster.normal += cross;
+            area += triangleArea;
+        }
+        meshCentroid += cluster.centroid;
+        meshArea += area;
+        cluster.centroid = area > 0.0f ? cluster.centroid / area : vertices[indices[cluster.first * 3]].Position;
+        clusters.push_back(cluster);
+    }
+    if (meshArea > 0.0f) {
+        meshCentroid /= meshArea;
     }
 
-    return Mesh(vertices, indices, textureID);
+    for (auto& cluster : clusters) {
+        float length = glm::length(cluster.normal);
+        cluster.sortKey = length > 0.0f ? glm::dot(cluster.centroid - meshCentroid, cluster.normal / length) : 0.0f;
+    }
+    std::stable_sort(clusters.begin(), clusters.end(), [](const Cluster& a, const Cluster& b) {
+        return a.sortKey > b.sortKey;
+    });
+
+    std::vector<unsigned int> result;
+    result.reserve(indices.size());
+    for (const auto& cluster : clusters) {
+        result.insert(result.end(), indices.begin() + cluster.first * 3, indices.begin() + (cluster.first + cluster.count) * 3);
+    }
+    return result;
 }
 
+// Renumber vertices in order of first use (unreferenced vertices are dropped)
+void optimizeVertexFetch(std::vector<Vertex>& vertices, std::vector<unsigned int>& indices) {
+    const unsigned int unassigned = ~0u;
+    std::vector<unsigned int> remap(vertices.size(), unassigned);
+    std::vector<Vertex> reordered;
+    reordered.reserve(vertices.size());
+    for (unsigned int& index : indices) {
+        if (remap[index] == unassigned) {
+            remap[index] = (unsigned int)reordered.size();
+            reordered.push_back(vertices[index]);
+        }
+        index = remap[index];
+    }
+    vertices.swap(reordered);
+}
 
+// Run the whole pipeline on one triangle-list mesh and report its cache statistics
+void optimizeMesh(std::vector<Vertex>& vertices, std::vector<unsigned int>& indices) {
+    PROFILE_ZONE("optimizeMesh");
+    if (indices.size() < 3 || indices.size() % 3 != 0) {
+        return;
+    }
+    VertexCacheStats before = measureVertexCache(indices, vertices.size());
+    indices = optimizeVertexCache(indices, vertices.size());
+    indices = optimizeOverdraw(indices, vertices);
+    optimizeVertexFetch(vertices, indices);
+    VertexCacheStats after = measureVertexCache(indices, vertices.size());
+
+    std::cout << "Mesh optimize: " << indices.size() / 3 << " triangles, ACMR " << before.acmr << " -> " << after.acmr
+        << ", ATVR " << before.atvr << " -> " << after.atvr << std::endl;
+}
 #pragma endregion
 #pragma region Camera Settings
 // Camera settings
@@ -188,6 +1111,7 @@ void updateCameraFront() {
 
 // Process input
 void processInput(GLFWwindow* window) {
+    PROFILE_ZONE("processInput");
     float cameraSpeed = 2.5f * deltaTime; // Adjust the speed based on frame time
 
     glm::vec3 newCameraPos = cameraPos; // Temporary variable for new position
@@ -225,226 +1149,3609 @@ void processInput(GLFWwindow* window) {
     // Update the view matrix based on camera position
     view = glm::lookAt(cameraPos, cameraPos + cameraFront, cameraUp);
 }
+
+// Returns true only on the frame a key goes down (for one-shot actions such as printing stats)
+bool keyPressed(GLFWwindow* window, int key) {
+    static bool wasDown[GLFW_KEY_LAST + 1] = {};
+    bool down = glfwGetKey(window, key) == GLFW_PRESS;
+    bool pressed = down && !wasDown[key];
+    wasDown[key] = down;
+    return pressed;
+}
 #pragma endregion
-#pragma region LOAD FUNCTIONS
-// Function to load a texture
-GLuint loadTexture(const char* path) {
-    GLuint textureID;
-    glGenTextures(1, &textureID);
+#pragma region Frustum Culling
+// View frustum as six planes (xyz = inward normal, w = distance), extracted from projection * view
+struct Frustum {
+    glm::vec4 planes[6];
+
+    // A box is outside if it lies entirely behind any plane; test the corner furthest along each normal
+    bool intersects(const AABB& box) const {
+        for (int i = 0; i < 6; i++) {
+            const glm::vec4& p = planes[i];
+            glm::vec3 positive(p.x >= 0.0f ? box.max.x : box.min.x,
+                               p.y >= 0.0f ? box.max.y : box.min.y,
+                               p.z >= 0.0f ? box.max.z : box.min.z);
+            if (p.x * positive.x + p.y * positive.y + p.z * positive.z + p.w < 0.0f) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
 
-    int width, height, nrChannels;
-    std::cout << "Loading texture: " << path << std::endl; // Debug log
+// Gribb/Hartmann plane extraction (glm matrices are column-major, so row i is m[0][i]..m[3][i])
+Frustum extractFrustum(const glm::mat4& m) {
+    glm::vec4 row0(m[0][0], m[1][0], m[2][0], m[3][0]);
+    glm::vec4 row1(m[0][1], m[1][1], m[2][1], m[3][1]);
+    glm::vec4 row2(m[0][2], m[1][2], m[2][2], m[3][2]);
+    glm::vec4 row3(m[0][3], m[1][3], m[2][3], m[3][3]);
+
+    Frustum frustum;
+    frustum.planes[0] = row3 + row0; // Left
+    frustum.planes[1] = row3 - row0; // Right
+    frustum.planes[2] = row3 + row1; // Bottom
+    frustum.planes[3] = row3 - row1; // Top
+    frustum.planes[4] = row3 + row2; // Near
+    frustum.planes[5] = row3 - row2; // Far
+
+    for (int i = 0; i < 6; i++) {
+        float length = glm::length(glm::vec3(frustum.planes[i]));
+        frustum.planes[i] = frustum.planes[i] / length;
+    }
+    return frustum;
+}
 
-    unsigned char* data = stbi_load(path, &width, &height, &nrChannels, 0);
-    if (data) {
-        GLenum format = (nrChannels == 4) ? GL_RGBA : GL_RGB;
-        glBindTexture(GL_TEXTURE_2D, textureID);
-        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
+// Per-frame culling pass state: the current frustum plus counters for the stats printout
+struct Culler {
+    Frustum frustum;
+    unsigned int tested = 0;
+    unsigned int culled = 0;
 
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    void beginFrame(const glm::mat4& viewProjection) {
+        frustum = extractFrustum(viewProjection);
+        tested = 0;
+        culled = 0;
+    }
 
-        stbi_image_free(data);
+    bool isVisible(const AABB& worldBounds) {
+        tested++;
+        if (!frustum.intersects(worldBounds)) {
+            culled++;
+            return false;
+        }
+        return true;
     }
-    else {
-        std::cerr << "Failed to load texture: " << path << std::endl; // Error log
-        std::cerr << "STB Reason: " << stbi_failure_reason() << std::endl; // Log reason
-        stbi_image_free(data);
+
+    bool isVisible(const AABB& localBounds, const glm::mat4& model) {
+        return isVisible(transformAABB(localBounds, model));
     }
+};
 
-    return textureID;
+// Bounds of one of the built-in interleaved quads (position is the first three floats of each vertex)
+AABB computeVertexBounds(const float* vertices, int vertexCount, int floatsPerVertex) {
+    AABB bounds;
+    for (int i = 0; i < vertexCount; i++) {
+        const float* v = vertices + i * floatsPerVertex;
+        bounds.expand(glm::vec3(v[0], v[1], v[2]));
+    }
+    return bounds;
 }
+#pragma endregion
+#pragma region Scene Transforms
+// Scene node: local translation/rotation/scale plus the cached world matrix and world-space bounds
+struct TransformNode {
+    glm::vec3 translation = glm::vec3(0.0f);
+    glm::quat rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
+    glm::vec3 scale = glm::vec3(1.0f);
+    int parent = -1;            // Index of the parent node, -1 for roots
+
+    AABB localBounds;           // Bounds of whatever is drawn with this node
+    glm::mat4 world = glm::mat4(1.0f);
+    AABB worldBounds;
+    bool dirty = true;          // Local TRS changed since the last update
+    bool changed = false;       // World matrix was recomputed in the last update (children must follow)
+};
 
-// Function to load a texture with transparent background
-GLuint loadTreeTexture(const char* filename) {
-    int width, height, channels;
-    unsigned char* data = stbi_load(filename, &width, &height, &channels, STBI_rgb_alpha); // Force RGBA (with alpha channel)
+// Flat list of transform nodes. Parents are always added before their children, so one forward pass
+// updates the hierarchy. Only dirty nodes (and the children of recomputed nodes) do any matrix math.
+class SceneGraph {
+public:
+    int addNode(const glm::vec3& translation, const glm::quat& rotation, const glm::vec3& scale, const AABB& localBounds, int parent = -1) {
+        TransformNode node;
+        node.translation = translation;
+        node.rotation = rotation;
+        node.scale = scale;
+        node.localBounds = localBounds;
+        node.parent = parent;
+        nodes.push_back(node);
+        return (int)nodes.size() - 1;
+    }
 
-    if (data) {
-        GLuint texture;
-        glGenTextures(1, &texture);
-        glBindTexture(GL_TEXTURE_2D, texture);
+    void setTranslation(int node, const glm::vec3& translation) { nodes[node].translation = translation; nodes[node].dirty = true; }
+    void setRotation(int node, const glm::quat& rotation) { nodes[node].rotation = rotation; nodes[node].dirty = true; }
+    void setScale(int node, const glm::vec3& scale) { nodes[node].scale = scale; nodes[node].dirty = true; }
+    void setLocalBounds(int node, const AABB& bounds) { nodes[node].localBounds = bounds; nodes[node].dirty = true; }
+
+    const glm::mat4& world(int node) const { return nodes[node].world; }
+    const AABB& worldBounds(int node) const { return nodes[node].worldBounds; }
+    bool hasChanged(int node) const { return nodes[node].changed; } // World matrix recomputed by the last update
+
+    // Recompute world matrices that are out of date; returns how many nodes were recomputed
+    unsigned int update() {
+        unsigned int recomputed = 0;
+        for (auto& node : nodes) {
+            bool parentChanged = node.parent >= 0 && nodes[node.parent].changed;
+            node.changed = node.dirty || parentChanged;
+            if (!node.changed) {
+                continue;
+            }
 
-        // Set texture parameters
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            glm::mat4 local = glm::translate(glm::mat4(1.0f), node.translation) * glm::mat4_cast(node.rotation);
+            local = glm::scale(local, node.scale);
+            node.world = node.parent >= 0 ? nodes[node.parent].world * local : local;
+            node.worldBounds = transformAABB(node.localBounds, node.world);
+            node.dirty = false;
+            recomputed++;
+        }
+        return recomputed;
+    }
 
-        // Upload texture data to OpenGL
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
+private:
+    std::vector<TransformNode> nodes;
+};
 
-        stbi_image_free(data);
-        return texture;
-    }
-    else {
-        std::cerr << "Failed to load texture" << std::endl;
-        return 0;
-    }
+// Rotation about the Y axis, in degrees
+glm::quat rotationY(float degrees) {
+    return glm::angleAxis(glm::radians(degrees), glm::vec3(0.0f, 1.0f, 0.0f));
 }
+#pragma endregion
+#pragma region Worker Pool
+// Fixed set of worker threads running queued jobs (used for startup work that does not touch GL, such as
+// image decoding). With no threads started, submit() runs the job on the calling thread.
+class WorkerPool {
+public:
+    void start(unsigned int threadCount) {
+        for (unsigned int i = 0; i < threadCount; i++) {
+            threads.push_back(std::thread([this, i]() {
+                PROFILE_THREAD_NAME("worker " + std::to_string(i + 1));
+                workerLoop();
+            }));
+        }
+    }
 
-// Load images to skybox Cubemap
-unsigned int loadCubemap(std::vector<std::string> faces) {
-    unsigned int textureID;
-    glGenTextures(1, &textureID);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
+    unsigned int size() const { return (unsigned int)threads.size(); }
 
-    int width, height, nrChannels;
-    for (unsigned int i = 0; i < faces.size(); i++) {
-        unsigned char* data = stbi_load(faces[i].c_str(), &width, &height, &nrChannels, 0);
-        if (data) {
-            // Check if the image has 3 or 4 channels and adjust the format
-            GLenum format = (nrChannels == 4) ? GL_RGBA : GL_RGB;
-            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i,
-                0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-            stbi_image_free(data);
+    void submit(std::function<void()> job) {
+        if (threads.empty()) {
+            job();
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            jobs.push_back(std::move(job));
+        }
+        jobReady.notify_one();
+    }
+
+    // Run body(0) .. body(count - 1) on the pool and the calling thread, returning once all have run. The
+    // caller works through the indices too, so this never waits on queued jobs and may be called from a job.
+    void parallelFor(size_t count, std::function<void(size_t)> body) {
+        struct Loop {
+            std::function<void(size_t)> body;
+            size_t count = 0;
+            std::atomic<size_t> next{ 0 };
+            std::atomic<size_t> done{ 0 };
+            std::mutex mutex;
+            std::condition_variable finished;
+        };
+        auto loop = std::make_shared<Loop>();
+        loop->body = std::move(body);
+        loop->count = count;
+        auto run = [](Loop& state) {
+            for (size_t i; (i = state.next.fetch_add(1)) < state.count;) {
+                state.body(i);
+                if (state.done.fetch_add(1) + 1 == state.count) {
+                    std::lock_guard<std::mutex> lock(state.mutex);
+                    state.finished.notify_all();
+                }
+            }
+        };
+        // Helpers that start after the indices have run out return without touching body
+        size_t helpers = std::min(threads.size(), count > 0 ? count - 1 : 0);
+        for (size_t h = 0; h < helpers; h++) {
+            submit([loop, run]() { run(*loop); });
+        }
+        run(*loop);
+        std::unique_lock<std::mutex> lock(loop->mutex);
+        loop->finished.wait(lock, [&loop]() { return loop->done.load() == loop->count; });
+    }
+
+    // Block until every submitted job has finished
+    void wait() {
+        std::unique_lock<std::mutex> lock(mutex);
+        jobsDone.wait(lock, [this]() { return jobs.empty() && running == 0; });
+    }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        jobReady.notify_all();
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        threads.clear();
+        stopping = false;
+    }
+
+private:
+    std::vector<std::thread> threads;
+    std::deque<std::function<void()>> jobs;
+    std::mutex mutex;
+    std::condition_variable jobReady;
+    std::condition_variable jobsDone;
+    unsigned int running = 0;
+    bool stopping = false;
+
+    void workerLoop() {
+        for (;;) {
+            std::function<void()> job;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                jobReady.wait(lock, [this]() { return stopping || !jobs.empty(); });
+                if (jobs.empty()) {
+                    return; // Stopping, and nothing left to run
+                }
+                job = std::move(jobs.front());
+                jobs.pop_front();
+                running++;
+            }
+            job();
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                running--;
+            }
+            jobsDone.notify_all();
+        }
+    }
+};
+
+WorkerPool workerPool;
+#pragma endregion
+#pragma region Asset Streaming
+// Moves decoded asset data to the GPU in bounded slices: at most bytesPerFrame per update(), so streaming
+// textures and vertex data in never stalls a frame. Image rows are written into a mapped pixel unpack buffer
+// (PBO), and the texture copy from it runs asynchronously on the GPU. Mapping with GL_MAP_INVALIDATE_BUFFER_BIT
+// lets the driver hand out fresh storage while earlier slices are still being copied, so the map does not
+// wait for the GPU. Buffer data is written into the target buffer slice by slice.
+// Source data must stay alive until the task's onDone callback runs (on the GL thread, inside update()).
+class AssetStreamer {
+public:
+    size_t bytesUploaded = 0;   // Total since create()
+
+    void create(size_t budget) {
+        bytesPerFrame = budget;
+        glGenBuffers(1, &pixelBuffer);
+    }
+
+    // Queue an image upload into one mip level of a texture: a layer of a 2D array (imageTarget = target),
+    // or a face of a cubemap (imageTarget = the face)
+    void queueImage(GLenum target, GLuint texture, GLenum imageTarget, int layer, int level, int width, int height,
+        GLenum format, int bytesPerPixel, const unsigned char* pixels, std::function<void()> onDone) {
+        Task task;
+        task.target = target;
+        task.object = texture;
+        task.imageTarget = imageTarget;
+        task.layer = layer;
+        task.level = level;
+        task.width = width;
+        task.height = height;
+        task.rowBytes = (size_t)width * bytesPerPixel;
+        task.format = format;
+        task.data = pixels;
+        task.size = task.rowBytes * height;
+        task.onDone = onDone;
+        tasks.push_back(task);
+    }
+
+    // Queue an upload of block-compressed data into one mip level (same targets as queueImage); slices are
+    // whole rows of 4x4 blocks
+    void queueCompressedImage(GLenum target, GLuint texture, GLenum imageTarget, int layer, int level, int width, int height,
+        GLenum internalFormat, int bytesPerBlock, const unsigned char* blocks, std::function<void()> onDone) {
+        Task task;
+        task.target = target;
+        task.object = texture;
+        task.imageTarget = imageTarget;
+        task.layer = layer;
+        task.level = level;
+        task.width = width;
+        task.height = height;
+        task.rowBytes = (size_t)((width + 3) / 4) * bytesPerBlock;
+        task.compressedFormat = internalFormat;
+        task.data = blocks;
+        task.size = task.rowBytes * ((height + 3) / 4);
+        task.onDone = onDone;
+        tasks.push_back(task);
+    }
+
+    // Queue a write of size bytes into a buffer object (which must already have its storage)
+    void queueBuffer(GLuint buffer, const void* data, size_t size, std::function<void()> onDone) {
+        Task task;
+        task.object = buffer;
+        task.data = (const unsigned char*)data;
+        task.size = size;
+        task.onDone = onDone;
+        tasks.push_back(task);
+    }
+
+    bool idle() const { return tasks.empty(); }
+
+    // Spend this frame's budget on the queued tasks, in order; a slice is at least one image row
+    void update() {
+        PROFILE_ZONE("AssetStreamer::update");
+        size_t budget = bytesPerFrame;
+        while (!tasks.empty() && budget > 0) {
+            Task& task = tasks.front();
+            size_t sent = task.rowBytes ? uploadRows(task, budget) : uploadBytes(task, budget);
+            bytesUploaded += sent;
+            budget -= std::min(sent, budget);
+            if (task.offset < task.size) {
+                break;
+            }
+            std::function<void()> onDone = task.onDone;
+            tasks.pop_front();
+            if (onDone) {
+                onDone();
+            }
+        }
+    }
+
+    void destroy() {
+        glDeleteBuffers(1, &pixelBuffer);
+        pixelBufferSize = 0;
+    }
+
+private:
+    struct Task {
+        GLenum target = 0;          // Texture target, 0 for a buffer write
+        GLuint object = 0;          // Texture or buffer name
+        GLenum imageTarget = 0;
+        int layer = 0;
+        int level = 0;
+        int width = 0;
+        int height = 0;
+        size_t rowBytes = 0;        // 0 for a buffer write; a row of blocks for compressed data
+        GLenum format = GL_RGBA;
+        GLenum compressedFormat = 0; // Internal format of block-compressed data, 0 for pixels
+        const unsigned char* data = nullptr;
+        size_t size = 0;
+        size_t offset = 0;          // Bytes already uploaded
+        std::function<void()> onDone;
+    };
+
+    std::deque<Task> tasks;
+    size_t bytesPerFrame = 0;
+    GLuint pixelBuffer = 0;
+    size_t pixelBufferSize = 0;  // Storage allocated for pixelBuffer; grows to the largest slice
+
+    size_t uploadRows(Task& task, size_t budget) {
+        size_t firstRow = task.offset / task.rowBytes;
+        size_t rows = std::max((size_t)1, budget / task.rowBytes);
+        rows = std::min(rows, task.size / task.rowBytes - firstRow);
+        size_t bytes = rows * task.rowBytes;
+
+        // Write the slice straight into the PBO's storage (no staging copy in the driver), then let the GPU
+        // copy it into the texture
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pixelBuffer);
+        if (bytes > pixelBufferSize) {
+            pixelBufferSize = bytes;
+            glBufferData(GL_PIXEL_UNPACK_BUFFER, pixelBufferSize, nullptr, GL_STREAM_DRAW);
+        }
+        void* mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+        bool written = mapped != nullptr;
+        if (written) {
+            std::memcpy(mapped, task.data + task.offset, bytes);
+            written = glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER) == GL_TRUE; // False if the storage was lost meanwhile
+        }
+        if (!written) {
+            glBufferSubData(GL_PIXEL_UNPACK_BUFFER, 0, bytes, task.data + task.offset);
+        }
+        glBindTexture(task.target, task.object);
+        if (task.compressedFormat) {
+            // A row here is a row of 4x4 blocks; the last one may cover fewer than 4 texel rows
+            GLint y = (GLint)firstRow * 4;
+            GLsizei height = std::min((GLsizei)rows * 4, (GLsizei)task.height - y);
+            if (task.target == GL_TEXTURE_2D_ARRAY) {
+                glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, task.level, 0, y, task.layer, task.width, height, 1, task.compressedFormat, (GLsizei)bytes, (void*)0);
+            }
+            else {
+                glCompressedTexSubImage2D(task.imageTarget, task.level, 0, y, task.width, height, task.compressedFormat, (GLsizei)bytes, (void*)0);
+            }
+        }
+        else if (task.target == GL_TEXTURE_2D_ARRAY) {
+            glTexSubImage3D(GL_TEXTURE_2D_ARRAY, task.level, 0, (GLint)firstRow, task.layer, task.width, (GLsizei)rows, 1, task.format, GL_UNSIGNED_BYTE, (void*)0);
         }
         else {
-            std::cout << "Cubemap texture failed to load at path: " << faces[i] << std::endl;
-            stbi_image_free(data);
+            glTexSubImage2D(task.imageTarget, task.level, 0, (GLint)firstRow, task.width, (GLsizei)rows, task.format, GL_UNSIGNED_BYTE, (void*)0);
         }
+        glBindTexture(task.target, 0);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0); // Later texture uploads read client memory again
+
+        task.offset += bytes;
+        return bytes;
     }
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
 
-    return textureID;
+    size_t uploadBytes(Task& task, size_t budget) {
+        size_t bytes = std::min(budget, task.size - task.offset);
+        // The copy-write target leaves the VAO's element buffer binding alone
+        glBindBuffer(GL_COPY_WRITE_BUFFER, task.object);
+        glBufferSubData(GL_COPY_WRITE_BUFFER, task.offset, bytes, task.data + task.offset);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        task.offset += bytes;
+        return bytes;
+    }
+};
+#pragma endregion
+#pragma region Mip Generation
+// Mip chains are built on the CPU (worker threads or the offline encoder) instead of with glGenerateMipmap.
+// Each level is a 2:1 reduction of the previous one with a Kaiser-windowed sinc filter, applied separably in
+// linear light on premultiplied colour so transparent texels do not darken their neighbours. For images with
+// transparent texels the alpha of every level is rescaled so the share of texels passing the fragment
+// shader's alpha test does not drop below level 0's; otherwise foliage thins out with distance.
+const float ALPHA_TEST_CUTOFF = 0.1f; // The fragment shader's discard threshold
+
+// Filter taps for a 2:1 reduction: source texels at offsets -3..4 from 2x, i.e. distances of
+// +-0.25, +-0.75, +-1.25, +-1.75 destination texels from the destination texel's centre
+struct MipFilter {
+    static const int TAPS = 8;
+    float weights[TAPS];
+
+    MipFilter() {
+        const float radius = 2.0f, alpha = 4.0f;
+        auto besselI0 = [](float x) {
+            float sum = 1.0f, term = 1.0f;
+            for (int k = 1; k < 16; k++) {
+                term *= (x / (2.0f * k)) * (x / (2.0f * k));
+                sum += term;
+            }
+            return sum;
+        };
+        float total = 0.0f;
+        for (int t = 0; t < TAPS; t++) {
+            float distance = (t - 3 - 0.5f) * 0.5f;
+            float sinc = std::sin(3.14159265f * distance) / (3.14159265f * distance);
+            float window = distance / radius;
+            weights[t] = sinc * besselI0(alpha * std::sqrt(std::max(0.0f, 1.0f - window * window))) / besselI0(alpha);
+            total += weights[t];
+        }
+        for (int t = 0; t < TAPS; t++) weights[t] /= total;
+    }
+};
+
+static float srgbToLinear(unsigned char value) {
+    static const std::vector<float> table = []() {
+        std::vector<float> values(256);
+        for (int i = 0; i < 256; i++) {
+            float c = i / 255.0f;
+            values[i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+        }
+        return values;
+    }();
+    return table[value];
+}
+
+static unsigned char linearToSrgb(float value) {
+    value = std::min(1.0f, std::max(0.0f, value));
+    float c = value <= 0.0031308f ? value * 12.92f : 1.055f * std::pow(value, 1.0f / 2.4f) - 0.055f;
+    return (unsigned char)(c * 255.0f + 0.5f);
+}
+
+// Halve one axis of a premultiplied RGBA float image (an axis already 1 texel long is copied). The inner
+// loop runs over a whole row of contiguous floats so the compiler can vectorise it.
+static void reduceAxis(const std::vector<float>& source, int width, int height, bool horizontal, bool wrap,
+    std::vector<float>& result) {
+    static const MipFilter filter;
+    int length = horizontal ? width : height;
+    int reduced = std::max(1, length / 2);
+    int resultWidth = horizontal ? reduced : width, resultHeight = horizontal ? height : reduced;
+    result.assign((size_t)resultWidth * resultHeight * 4, 0.0f);
+    if (length == 1) {
+        result = source;
+        return;
+    }
+
+    for (int i = 0; i < reduced; i++) {
+        for (int t = 0; t < MipFilter::TAPS; t++) {
+            int s = 2 * i + t - 3;
+            s = wrap ? ((s % length) + length) % length : std::min(length - 1, std::max(0, s));
+            float weight = filter.weights[t];
+            if (horizontal) {
+                // Column s of every row contributes to column i
+                for (int y = 0; y < height; y++) {
+                    const float* in = &source[((size_t)y * width + s) * 4];
+                    float* out = &result[((size_t)y * resultWidth + i) * 4];
+                    for (int c = 0; c < 4; c++) out[c] += weight * in[c];
+                }
+            }
+            else {
+                const float* in = &source[(size_t)s * width * 4];
+                float* out = &result[(size_t)i * width * 4];
+                for (int x = 0; x < width * 4; x++) out[x] += weight * in[x];
+            }
+        }
+    }
+}
+
+// Share of texels passing the alpha test once their alpha is multiplied by scale
+static float alphaCoverage(const std::vector<float>& alpha, float scale) {
+    size_t passing = 0;
+    for (float a : alpha) {
+        if (a * scale > ALPHA_TEST_CUTOFF) passing++;
+    }
+    return (float)passing / (float)alpha.size();
+}
+
+// The levels below an RGBA8 image (level 1 down to 1x1, each RGBA8); wrap selects repeat or clamp-to-edge
+// addressing at the borders
+void buildMipChain(const unsigned char* rgba, int width, int height, bool wrap, std::vector<std::vector<unsigned char>>& levels) {
+    PROFILE_ZONE("buildMipChain");
+    levels.clear();
+    size_t texels = (size_t)width * height;
+    std::vector<float> current(texels * 4), temporary, next;
+    bool transparent = false;
+    std::vector<float> baseAlpha(texels);
+    for (size_t i = 0; i < texels; i++) {
+        float alpha = rgba[i * 4 + 3] / 255.0f;
+        for (int c = 0; c < 3; c++) current[i * 4 + c] = srgbToLinear(rgba[i * 4 + c]) * alpha;
+        current[i * 4 + 3] = alpha;
+        baseAlpha[i] = alpha;
+        transparent = transparent || rgba[i * 4 + 3] != 255;
+    }
+    float targetCoverage = transparent ? alphaCoverage(baseAlpha, 1.0f) : 1.0f;
+
+    int levelWidth = width, levelHeight = height;
+    while (levelWidth > 1 || levelHeight > 1) {
+        reduceAxis(current, levelWidth, levelHeight, true, wrap, temporary);
+        levelWidth = std::max(1, levelWidth / 2);
+        reduceAxis(temporary, levelWidth, levelHeight, false, wrap, next);
+        levelHeight = std::max(1, levelHeight / 2);
+        current.swap(next);
+
+        size_t levelTexels = (size_t)levelWidth * levelHeight;
+        std::vector<float> alpha(levelTexels);
+        for (size_t i = 0; i < levelTexels; i++) alpha[i] = std::min(1.0f, std::max(0.0f, current[i * 4 + 3]));
+
+        // Binary search for the smallest alpha scale that restores the base level's coverage. Alpha is only
+        // ever raised: a level that already covers more keeps its filtered alpha. The filtered chain itself
+        // stays unscaled, so the error does not compound from level to level.
+        float scale = 1.0f;
+        if (transparent && alphaCoverage(alpha, 1.0f) < targetCoverage) {
+            float low = 1.0f, high = 4.0f;
+            for (int step = 0; step < 12; step++) {
+                scale = 0.5f * (low + high);
+                if (alphaCoverage(alpha, scale) < targetCoverage) low = scale;
+                else high = scale;
+            }
+            scale = high;
+        }
+
+        std::vector<unsigned char> level(levelTexels * 4);
+        for (size_t i = 0; i < levelTexels; i++) {
+            float a = alpha[i];
+            for (int c = 0; c < 3; c++) level[i * 4 + c] = linearToSrgb(a > 0.0f ? current[i * 4 + c] / a : 0.0f);
+            level[i * 4 + 3] = (unsigned char)(std::min(1.0f, a * scale) * 255.0f + 0.5f);
+        }
+        levels.push_back(std::move(level));
+    }
 }
 #pragma endregion
-#pragma region Shaders
-// Shader code
-const char* vertexShaderSource = R"(
-#version 330 core
-layout (location = 0) in vec3 aPos;
-layout (location = 1) in vec2 aTexCoord;
+#pragma region Texture Compression
+// Block-compressed (BCn) textures stored in KTX2 containers next to their source images ("<image>.ktx2").
+// The encoder runs offline on the CPU (--encode-textures): opaque images become BC1 (8 bytes per 4x4 block),
+// images with alpha BC3 (16 bytes), or everything BC7 mode 6 when that is selected. Level 0 plus its mip
+// chain (buildMipChain) is encoded, so a load only reads the file and uploads the blocks. A normal start never
+// encodes: a missing KTX2 file, one older than its source, or one written by an older version of the encoder
+// is skipped and the image is uploaded uncompressed. Only what this program writes is read back:
+// BC1/BC3/BC7 UNORM, one face, no supercompression.
+enum BlockFormat {
+    BLOCK_NONE,     // Not compressed (uploaded as RGBA8)
+    BLOCK_BC1,
+    BLOCK_BC3,
+    BLOCK_BC7
+};
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+// Which encoding new KTX2 files use (set from the command line before any texture is registered)
+enum TextureCompression {
+    COMPRESSION_OFF,    // Upload the decoded images as RGBA8 and ignore KTX2 files
+    COMPRESSION_BC,     // BC1 for opaque images, BC3 for images with alpha
+    COMPRESSION_BC7     // BC7 for every image
+};
 
-out vec2 TexCoord;
-out vec3 FragPos;
+TextureCompression textureCompression = COMPRESSION_BC;
 
-void main() {
-    gl_Position = projection * view * model * vec4(aPos, 1.0);
-    TexCoord = aTexCoord;
+// Set by --encode-textures: missing or stale KTX2 files are encoded and written instead of skipped
+bool encodeTextures = false;
+
+// A block-compressed image and its mip chain (level 0 first)
+struct CompressedImage {
+    BlockFormat format = BLOCK_NONE;
+    int width = 0, height = 0;
+    std::vector<std::vector<unsigned char>> levels;
+};
 
-    FragPos = vec3(model * vec4(aPos, 1.0));
+int blockBytes(BlockFormat format) {
+    return format == BLOCK_BC1 ? 8 : 16;
 }
-)";
 
-const char* fragmentShaderSource = R"(
-#version 330 core
-out vec4 FragColor;
+GLenum blockGLFormat(BlockFormat format) {
+    switch (format) {
+    case BLOCK_BC1: return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+    case BLOCK_BC3: return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+    default: return GL_COMPRESSED_RGBA_BPTC_UNORM;
+    }
+}
 
-in vec2 TexCoord;
+const char* blockFormatName(BlockFormat format) {
+    switch (format) {
+    case BLOCK_BC1: return "BC1";
+    case BLOCK_BC3: return "BC3";
+    case BLOCK_BC7: return "BC7";
+    default: return "RGBA8";
+    }
+}
 
-in vec3 FragPos; // Pass the fragment position from the vertex shader
+size_t compressedLevelSize(BlockFormat format, int width, int height) {
+    return (size_t)((width + 3) / 4) * ((height + 3) / 4) * blockBytes(format);
+}
 
-uniform sampler2D texture1;
-uniform vec3 cameraPos; // Camera position
-uniform float fogStart; // Fog start distance
-uniform float fogEnd;   // Fog end distance
-uniform vec4 fogColor;  // Fog color
+int mipDimension(int size, int level) {
+    return std::max(1, size >> level);
+}
 
-void main() {
-    // Fetch texture color
-    vec4 texColor = texture(texture1, TexCoord);
+// The 4x4 texels at block (bx, by) of an RGBA8 image; blocks past the right or bottom edge repeat the edge
+static void fetchBlock(const unsigned char* rgba, int width, int height, int bx, int by, unsigned char block[64]) {
+    for (int y = 0; y < 4; y++) {
+        int sy = std::min(by * 4 + y, height - 1);
+        for (int x = 0; x < 4; x++) {
+            int sx = std::min(bx * 4 + x, width - 1);
+            std::memcpy(block + (y * 4 + x) * 4, rgba + ((size_t)sy * width + sx) * 4, 4);
+        }
+    }
+}
 
-    // Skip fog blending for fully transparent pixels
-    if (texColor.a < 0.1) {
-        discard;
+// End points of the line through the block's texels along their principal axis (the first channels
+// only), found by power iteration on the covariance matrix and clamped to the colour range
+static void principalEndpoints(const unsigned char block[64], int channels, float lo[4], float hi[4]) {
+    float mean[4] = { 0, 0, 0, 0 };
+    float minValue[4] = { 255, 255, 255, 255 };
+    float maxValue[4] = { 0, 0, 0, 0 };
+    for (int i = 0; i < 16; i++) {
+        for (int c = 0; c < channels; c++) {
+            float v = block[i * 4 + c];
+            mean[c] += v / 16.0f;
+            minValue[c] = std::min(minValue[c], v);
+            maxValue[c] = std::max(maxValue[c], v);
+        }
     }
-    
-    // Calculate distance from camera to the fragment
-    float distance = length(cameraPos - FragPos);
-    
-    // Calculate fog factor (linear fade)
-    float fogFactor = clamp((fogEnd - distance) / (fogEnd - fogStart), 0.0, 1.0);
-    
-    // Blend the fog color with the texture color based on fog factor
-    vec4 color = mix(texColor, fogColor, fogFactor);
 
-    FragColor = color;
+    float covariance[4][4] = {};
+    for (int i = 0; i < 16; i++) {
+        for (int a = 0; a < channels; a++) {
+            for (int b = 0; b < channels; b++) {
+                covariance[a][b] += (block[i * 4 + a] - mean[a]) * (block[i * 4 + b] - mean[b]);
+            }
+        }
+    }
+
+    float axis[4];
+    for (int c = 0; c < channels; c++) axis[c] = maxValue[c] - minValue[c];
+    for (int iteration = 0; iteration < 8; iteration++) {
+        float next[4] = { 0, 0, 0, 0 };
+        float length = 0.0f;
+        for (int a = 0; a < channels; a++) {
+            for (int b = 0; b < channels; b++) next[a] += covariance[a][b] * axis[b];
+            length = std::max(length, std::fabs(next[a]));
+        }
+        if (length < 1e-6f) {
+            break; // Flat block (or already converged to zero): keep the bounding box diagonal
+        }
+        for (int c = 0; c < channels; c++) axis[c] = next[c] / length;
+    }
+
+    float axisLength = 0.0f;
+    for (int c = 0; c < channels; c++) axisLength += axis[c] * axis[c];
+    if (axisLength < 1e-12f) {
+        for (int c = 0; c < channels; c++) lo[c] = hi[c] = mean[c];
+        return;
+    }
+    float minProjection = FLT_MAX, maxProjection = -FLT_MAX;
+    for (int i = 0; i < 16; i++) {
+        float projection = 0.0f;
+        for (int c = 0; c < channels; c++) projection += (block[i * 4 + c] - mean[c]) * axis[c];
+        minProjection = std::min(minProjection, projection / axisLength);
+        maxProjection = std::max(maxProjection, projection / axisLength);
+    }
+    for (int c = 0; c < channels; c++) {
+        lo[c] = std::min(255.0f, std::max(0.0f, mean[c] + axis[c] * minProjection));
+        hi[c] = std::min(255.0f, std::max(0.0f, mean[c] + axis[c] * maxProjection));
+    }
 }
-)";
 
-const char* skyboxVertexShaderSource = R"(
-#version 330 core
-layout (location = 0) in vec3 aPos;
+static int nearestEntry(const unsigned char* texel, const int (*palette)[4], int entries, int channels) {
+    int best = 0, bestDistance = INT32_MAX;
+    for (int e = 0; e < entries; e++) {
+        int distance = 0;
+        for (int c = 0; c < channels; c++) {
+            int d = texel[c] - palette[e][c];
+            distance += d * d;
+        }
+        if (distance < bestDistance) {
+            bestDistance = distance;
+            best = e;
+        }
+    }
+    return best;
+}
 
-out vec3 TexCoords;
+static uint16_t packRGB565(const float color[3]) {
+    int r = (int)(color[0] * 31.0f / 255.0f + 0.5f);
+    int g = (int)(color[1] * 63.0f / 255.0f + 0.5f);
+    int b = (int)(color[2] * 31.0f / 255.0f + 0.5f);
+    return (uint16_t)((r << 11) | (g << 5) | b);
+}
 
-uniform mat4 view;
-uniform mat4 projection;
+static void unpackRGB565(uint16_t value, int color[4]) {
+    int r = value >> 11, g = (value >> 5) & 63, b = value & 31;
+    color[0] = (r << 3) | (r >> 2);
+    color[1] = (g << 2) | (g >> 4);
+    color[2] = (b << 3) | (b >> 2);
+    color[3] = 255;
+}
 
-void main() {
-    TexCoords = aPos;
-    vec4 pos = projection * view * vec4(aPos, 1.0);
-    gl_Position = pos.xyww; // Keep depth at maximum to prevent z-fighting
+// BC1 colour block (always the four-colour mode, which is also how BC3 decodes its colour half)
+void encodeBC1Block(const unsigned char block[64], unsigned char out[8]) {
+    float lo[4], hi[4];
+    principalEndpoints(block, 3, lo, hi);
+    uint16_t color0 = packRGB565(hi), color1 = packRGB565(lo);
+    if (color0 < color1) {
+        std::swap(color0, color1);
+    }
+
+    uint32_t indices = 0;
+    if (color0 != color1) {
+        int palette[4][4];
+        unpackRGB565(color0, palette[0]);
+        unpackRGB565(color1, palette[1]);
+        for (int c = 0; c < 3; c++) {
+            palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+            palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+        }
+        for (int i = 0; i < 16; i++) {
+            indices |= (uint32_t)nearestEntry(block + i * 4, palette, 4, 3) << (2 * i);
+        }
+    }
+    out[0] = (unsigned char)(color0 & 0xFF);
+    out[1] = (unsigned char)(color0 >> 8);
+    out[2] = (unsigned char)(color1 & 0xFF);
+    out[3] = (unsigned char)(color1 >> 8);
+    std::memcpy(out + 4, &indices, 4);
 }
-)";
 
-const char* skyboxFragmentShaderSource = R"(
-#version 330 core
-out vec4 FragColor;
+// BC3 alpha half: the block's alpha range with six interpolated steps, three index bits per texel
+static void encodeAlphaBlock(const unsigned char block[64], unsigned char out[8]) {
+    int alpha0 = 0, alpha1 = 255;
+    for (int i = 0; i < 16; i++) {
+        alpha0 = std::max(alpha0, (int)block[i * 4 + 3]);
+        alpha1 = std::min(alpha1, (int)block[i * 4 + 3]);
+    }
 
-in vec3 TexCoords;
+    uint64_t indices = 0;
+    if (alpha0 > alpha1) {
+        int palette[8];
+        palette[0] = alpha0;
+        palette[1] = alpha1;
+        for (int i = 2; i < 8; i++) {
+            palette[i] = ((8 - i) * alpha0 + (i - 1) * alpha1) / 7;
+        }
+        for (int i = 0; i < 16; i++) {
+            int best = 0, bestDistance = 256;
+            for (int e = 0; e < 8; e++) {
+                int distance = std::abs(block[i * 4 + 3] - palette[e]);
+                if (distance < bestDistance) {
+                    bestDistance = distance;
+                    best = e;
+                }
+            }
+            indices |= (uint64_t)best << (3 * i);
+        }
+    }
+    out[0] = (unsigned char)alpha0;
+    out[1] = (unsigned char)alpha1;
+    for (int i = 0; i < 6; i++) {
+        out[2 + i] = (unsigned char)(indices >> (8 * i));
+    }
+}
 
-uniform samplerCube skybox;
+void encodeBC3Block(const unsigned char block[64], unsigned char out[16]) {
+    encodeAlphaBlock(block, out);
+    encodeBC1Block(block, out + 8);
+}
 
-uniform vec3 cameraPos; // Camera position
-uniform float fogStart; // Fog start distance
-uniform float fogEnd;   // Fog end distance
-uniform vec4 fogColor;  // Fog color
+// Nearest 7-bit BC7 mode 6 end point with a shared p-bit (the 8-bit value is (q << 1) | pbit)
+static void quantizeBC7Endpoint(const float value[4], int quantized[4], int& pbit) {
+    float bestError = FLT_MAX;
+    for (int p = 0; p < 2; p++) {
+        int candidate[4];
+        float error = 0.0f;
+        for (int c = 0; c < 4; c++) {
+            candidate[c] = std::min(127, std::max(0, (int)((value[c] - p) * 0.5f + 0.5f)));
+            float d = (float)((candidate[c] << 1) | p) - value[c];
+            error += d * d;
+        }
+        if (error < bestError) {
+            bestError = error;
+            pbit = p;
+            std::memcpy(quantized, candidate, sizeof(candidate));
+        }
+    }
+}
 
-void main() {
-    // Sample the skybox texture
-    vec4 skyboxColor = texture(skybox, TexCoords);
+// BC7 mode 6: one RGBA line per block with 7-bit end points, p-bits and 4-bit indices
+void encodeBC7Block(const unsigned char block[64], unsigned char out[16]) {
+    static const int weights[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+    float lo[4], hi[4];
+    principalEndpoints(block, 4, lo, hi);
+    int endpoints[2][4], pbits[2];
+    quantizeBC7Endpoint(lo, endpoints[0], pbits[0]);
+    quantizeBC7Endpoint(hi, endpoints[1], pbits[1]);
+
+    int palette[16][4];
+    for (int c = 0; c < 4; c++) {
+        int e0 = (endpoints[0][c] << 1) | pbits[0];
+        int e1 = (endpoints[1][c] << 1) | pbits[1];
+        for (int i = 0; i < 16; i++) {
+            palette[i][c] = ((64 - weights[i]) * e0 + weights[i] * e1 + 32) >> 6;
+        }
+    }
+    int indices[16];
+    for (int i = 0; i < 16; i++) {
+        indices[i] = nearestEntry(block + i * 4, palette, 16, 4);
+    }
+    // The first texel's index is stored without its top bit, so it must be below 8
+    if (indices[0] >= 8) {
+        std::swap(endpoints[0], endpoints[1]);
+        std::swap(pbits[0], pbits[1]);
+        for (int i = 0; i < 16; i++) indices[i] = 15 - indices[i];
+    }
 
-    // Calculate the distance from the camera to the "infinity"
-    // For a skybox, use a fixed distance to simulate infinity, e.g., fogEnd + buffer
-    float fogDistance = fogEnd + 10.0;
+    std::memset(out, 0, 16);
+    int bit = 0;
+    auto write = [out, &bit](uint32_t value, int count) {
+        for (int i = 0; i < count; i++, bit++) {
+            if ((value >> i) & 1) out[bit >> 3] |= (unsigned char)(1 << (bit & 7));
+        }
+    };
+    write(1 << 6, 7); // Mode 6
+    for (int c = 0; c < 4; c++) {
+        write(endpoints[0][c], 7);
+        write(endpoints[1][c], 7);
+    }
+    write(pbits[0], 1);
+    write(pbits[1], 1);
+    for (int i = 0; i < 16; i++) {
+        write(indices[i], i == 0 ? 3 : 4);
+    }
+}
+
+// Encoding for an image under the current compression setting
+BlockFormat chooseBlockFormat(const unsigned char* rgba, int width, int height) {
+    if (textureCompression == COMPRESSION_BC7) {
+        return BLOCK_BC7;
+    }
+    for (size_t i = 0; i < (size_t)width * height; i++) {
+        if (rgba[i * 4 + 3] != 255) {
+            return BLOCK_BC3;
+        }
+    }
+    return BLOCK_BC1;
+}
+
+// Block-compress an RGBA8 image and every level of its mip chain down to 1x1
+void compressImage(const unsigned char* rgba, int width, int height, BlockFormat format, bool wrap, CompressedImage& image) {
+    PROFILE_ZONE("compressImage");
+    image.format = format;
+    image.width = width;
+    image.height = height;
+    image.levels.clear();
+
+    std::vector<std::vector<unsigned char>> mips;
+    buildMipChain(rgba, width, height, wrap, mips);
+    for (size_t level = 0; level <= mips.size(); level++) {
+        const unsigned char* texels = level == 0 ? rgba : mips[level - 1].data();
+        int levelWidth = mipDimension(width, (int)level), levelHeight = mipDimension(height, (int)level);
+        int blocksX = (levelWidth + 3) / 4, blocksY = (levelHeight + 3) / 4;
+        std::vector<unsigned char> blocks(compressedLevelSize(format, levelWidth, levelHeight));
+        unsigned char block[64];
+        for (int by = 0; by < blocksY; by++) {
+            for (int bx = 0; bx < blocksX; bx++) {
+                fetchBlock(texels, levelWidth, levelHeight, bx, by, block);
+                unsigned char* out = blocks.data() + ((size_t)by * blocksX + bx) * blockBytes(format);
+                if (format == BLOCK_BC1) encodeBC1Block(block, out);
+                else if (format == BLOCK_BC3) encodeBC3Block(block, out);
+                else encodeBC7Block(block, out);
+            }
+        }
+        image.levels.push_back(std::move(blocks));
+    }
+}
+
+static const unsigned char KTX2_IDENTIFIER[12] = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+
+// Vulkan format numbers used by KTX2
+const uint32_t VK_FORMAT_BC1_RGB_UNORM = 131;
+const uint32_t VK_FORMAT_BC3_UNORM = 137;
+const uint32_t VK_FORMAT_BC7_UNORM = 145;
+
+// The file header after the identifier (68 bytes). sgdByteOffset sits at file offset 64, which is only
+// 4-byte aligned, so the struct is packed to 4 bytes to keep the compiler from padding before it.
+#pragma pack(push, 4)
+struct Ktx2Header {
+    uint32_t vkFormat;
+    uint32_t typeSize;
+    uint32_t pixelWidth;
+    uint32_t pixelHeight;
+    uint32_t pixelDepth;
+    uint32_t layerCount;
+    uint32_t faceCount;
+    uint32_t levelCount;
+    uint32_t supercompressionScheme;
+    uint32_t dfdByteOffset;
+    uint32_t dfdByteLength;
+    uint32_t kvdByteOffset;
+    uint32_t kvdByteLength;
+    uint64_t sgdByteOffset;
+    uint64_t sgdByteLength;
+};
+#pragma pack(pop)
+static_assert(sizeof(Ktx2Header) == 68, "Ktx2Header must match the KTX2 file header");
+
+// One level index entry; the index follows the header at file offset 80
+struct Ktx2Level {
+    uint64_t byteOffset;
+    uint64_t byteLength;
+    uint64_t uncompressedByteLength;
+};
+static_assert(sizeof(Ktx2Level) == 24, "Ktx2Level must match a KTX2 level index entry");
+
+// KTXwriter value of the files this program writes; files from another writer (or an older version of
+// this one, e.g. before mips were built with buildMipChain or the header was written at its spec size) are re-encoded
+const char* KTX2_WRITER = "MedievalSceneVS texture encoder 3";
+
+std::string ktx2Path(const std::string& imagePath) {
+    return imagePath + ".ktx2";
+}
+
+// Basic data format descriptor for a BCn format: one sample per 64-bit half of the block
+static std::vector<uint32_t> blockFormatDescriptor(BlockFormat format) {
+    struct Sample { uint32_t bitOffset, channel; };
+    std::vector<Sample> samples;
+    uint32_t colorModel;
+    if (format == BLOCK_BC1) {
+        colorModel = 128; // KHR_DF_MODEL_BC1A
+        samples.push_back({ 0, 0 });
+    }
+    else if (format == BLOCK_BC3) {
+        colorModel = 130; // KHR_DF_MODEL_BC3
+        samples.push_back({ 0, 15 });   // Alpha
+        samples.push_back({ 64, 0 });   // Colour
+    }
+    else {
+        colorModel = 134; // KHR_DF_MODEL_BC7
+        samples.push_back({ 0, 0 });
+    }
+
+    uint32_t blockSize = 24 + 16 * (uint32_t)samples.size();
+    std::vector<uint32_t> words;
+    words.push_back(4 + blockSize);                             // Total descriptor size
+    words.push_back(0);                                         // Khronos vendor, basic descriptor type
+    words.push_back(2 | (blockSize << 16));                     // Version 2
+    words.push_back(colorModel | (1 << 8) | (1 << 16));         // BT.709 primaries, linear transfer
+    words.push_back(3 | (3 << 8));                              // 4x4 texel blocks
+    words.push_back((uint32_t)blockBytes(format));              // Bytes per block
+    words.push_back(0);
+    for (const auto& sample : samples) {
+        uint32_t bitLength = format == BLOCK_BC7 ? 127 : 63;
+        words.push_back(sample.bitOffset | (bitLength << 16) | (sample.channel << 24));
+        words.push_back(0);
+        words.push_back(0);
+        words.push_back(0xFFFFFFFFu);
+    }
+    return words;
+}
+
+// Write a compressed image as a KTX2 file (mip data stored smallest level first, as the format requires)
+bool writeKtx2(const std::string& path, const CompressedImage& image) {
+    std::vector<uint32_t> descriptor = blockFormatDescriptor(image.format);
+    uint32_t levelCount = (uint32_t)image.levels.size();
+
+    Ktx2Header header = {};
+    header.vkFormat = image.format == BLOCK_BC1 ? VK_FORMAT_BC1_RGB_UNORM : image.format == BLOCK_BC3 ? VK_FORMAT_BC3_UNORM : VK_FORMAT_BC7_UNORM;
+    header.typeSize = 1;
+    header.pixelWidth = (uint32_t)image.width;
+    header.pixelHeight = (uint32_t)image.height;
+    header.faceCount = 1;
+    header.levelCount = levelCount;
+    header.dfdByteOffset = (uint32_t)(sizeof(KTX2_IDENTIFIER) + sizeof(Ktx2Header) + levelCount * sizeof(Ktx2Level));
+    header.dfdByteLength = (uint32_t)(descriptor.size() * sizeof(uint32_t));
+
+    // One key/value entry: "KTXwriter", NUL-terminated key and value, padded to 4 bytes
+    std::string writerEntry = std::string("KTXwriter") + '\0' + KTX2_WRITER + '\0';
+    uint32_t writerEntryLength = (uint32_t)writerEntry.size();
+    header.kvdByteOffset = header.dfdByteOffset + header.dfdByteLength;
+    header.kvdByteLength = (uint32_t)((sizeof(uint32_t) + writerEntry.size() + 3) & ~(size_t)3);
+
+    // Level data starts aligned to the block size, each level padded to it
+    size_t alignment = (size_t)blockBytes(image.format);
+    size_t offset = (header.kvdByteOffset + header.kvdByteLength + alignment - 1) / alignment * alignment;
+    std::vector<Ktx2Level> levelIndex(levelCount);
+    for (uint32_t level = levelCount; level-- > 0;) {
+        levelIndex[level].byteOffset = offset;
+        levelIndex[level].byteLength = image.levels[level].size();
+        levelIndex[level].uncompressedByteLength = image.levels[level].size();
+        offset += image.levels[level].size();
+    }
+
+    std::vector<unsigned char> file(offset, 0);
+    unsigned char* cursor = file.data();
+    std::memcpy(cursor, KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER));
+    std::memcpy(cursor + sizeof(KTX2_IDENTIFIER), &header, sizeof(header));
+    std::memcpy(cursor + sizeof(KTX2_IDENTIFIER) + sizeof(header), levelIndex.data(), levelCount * sizeof(Ktx2Level));
+    std::memcpy(cursor + header.dfdByteOffset, descriptor.data(), header.dfdByteLength);
+    std::memcpy(cursor + header.kvdByteOffset, &writerEntryLength, sizeof(writerEntryLength));
+    std::memcpy(cursor + header.kvdByteOffset + sizeof(writerEntryLength), writerEntry.data(), writerEntry.size());
+    for (uint32_t level = 0; level < levelCount; level++) {
+        std::memcpy(cursor + levelIndex[level].byteOffset, image.levels[level].data(), image.levels[level].size());
+    }
+
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write((const char*)file.data(), (std::streamsize)file.size());
+    return (bool)out;
+}
+
+// Read a KTX2 file written by writeKtx2; false if it is missing or not a layout this loader handles
+bool readKtx2(const std::string& path, CompressedImage& image) {
+    std::ifstream in(path, std::ios::binary | std::ios::ate);
+    if (!in) {
+        return false;
+    }
+    std::vector<unsigned char> file((size_t)in.tellg());
+    in.seekg(0);
+    in.read((char*)file.data(), (std::streamsize)file.size());
+    if (!in || file.size() < sizeof(KTX2_IDENTIFIER) + sizeof(Ktx2Header) ||
+        std::memcmp(file.data(), KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER)) != 0) {
+        return false;
+    }
+
+    Ktx2Header header;
+    std::memcpy(&header, file.data() + sizeof(KTX2_IDENTIFIER), sizeof(header));
+    BlockFormat format = header.vkFormat == VK_FORMAT_BC1_RGB_UNORM ? BLOCK_BC1 :
+        header.vkFormat == VK_FORMAT_BC3_UNORM ? BLOCK_BC3 :
+        header.vkFormat == VK_FORMAT_BC7_UNORM ? BLOCK_BC7 : BLOCK_NONE;
+    if (format == BLOCK_NONE || header.supercompressionScheme != 0 || header.faceCount != 1 || header.layerCount > 1 ||
+        header.pixelDepth > 1 || header.pixelWidth == 0 || header.pixelHeight == 0 || header.levelCount == 0 ||
+        header.levelCount > 16 || file.size() < sizeof(KTX2_IDENTIFIER) + sizeof(Ktx2Header) + header.levelCount * sizeof(Ktx2Level)) {
+        return false;
+    }
+
+    // The key/value data must start with this program's KTXwriter entry
+    std::string writerEntry = std::string("KTXwriter") + '\0' + KTX2_WRITER + '\0';
+    uint32_t writerEntryLength = 0;
+    if (header.kvdByteLength < sizeof(uint32_t) + writerEntry.size() || header.kvdByteOffset > file.size() ||
+        file.size() - header.kvdByteOffset < header.kvdByteLength) {
+        return false;
+    }
+    std::memcpy(&writerEntryLength, file.data() + header.kvdByteOffset, sizeof(writerEntryLength));
+    if (writerEntryLength != writerEntry.size() ||
+        std::memcmp(file.data() + header.kvdByteOffset + sizeof(uint32_t), writerEntry.data(), writerEntry.size()) != 0) {
+        return false;
+    }
+
+    image.format = format;
+    image.width = (int)header.pixelWidth;
+    image.height = (int)header.pixelHeight;
+    image.levels.assign(header.levelCount, std::vector<unsigned char>());
+    for (uint32_t level = 0; level < header.levelCount; level++) {
+        Ktx2Level entry;
+        std::memcpy(&entry, file.data() + sizeof(KTX2_IDENTIFIER) + sizeof(Ktx2Header) + level * sizeof(Ktx2Level), sizeof(entry));
+        size_t expected = compressedLevelSize(format, mipDimension(image.width, level), mipDimension(image.height, level));
+        if (entry.byteLength != expected || entry.byteOffset > file.size() || file.size() - entry.byteOffset < entry.byteLength) {
+            return false;
+        }
+        image.levels[level].assign(file.data() + entry.byteOffset, file.data() + entry.byteOffset + entry.byteLength);
+    }
+    return true;
+}
+
+bool getSourceStamp(const std::string& path, uint64_t& size, int64_t& time);
+
+// Compressed version of an image file with its mip chain (filtered with repeat or clamp-to-edge addressing).
+// Reads "<image>.ktx2" when it is at least as new as the image and matches the compression setting. When
+// encoding, a missing or stale file is encoded from the image and written; otherwise the result is false and
+// the caller uploads the image uncompressed. Also false when compression is off. Opaque images (cubemap
+// faces, which must all share one format) are always BC1 under COMPRESSION_BC, whatever their alpha.
+bool loadCompressedImage(const std::string& path, bool wrap, bool opaque, CompressedImage& image) {
+    if (textureCompression == COMPRESSION_OFF) {
+        return false;
+    }
+    std::string compressedPath = ktx2Path(path);
+    uint64_t sourceSize = 0, compressedSize = 0;
+    int64_t sourceTime = 0, compressedTime = 0;
+    bool haveSource = getSourceStamp(path, sourceSize, sourceTime);
+    bool haveCompressed = getSourceStamp(compressedPath, compressedSize, compressedTime);
+
+    bool upToDate = haveCompressed && (!haveSource || compressedTime >= sourceTime) && readKtx2(compressedPath, image) &&
+        (textureCompression == COMPRESSION_BC7) == (image.format == BLOCK_BC7) && !(opaque && image.format == BLOCK_BC3);
+    if (!upToDate) {
+        if (!encodeTextures || !haveSource) {
+            image = CompressedImage(); // A file read with the wrong format must not be uploaded
+            return false;
+        }
+        int width, height, nrChannels;
+        unsigned char* pixels = stbi_load(path.c_str(), &width, &height, &nrChannels, STBI_rgb_alpha);
+        if (!pixels) {
+            return false;
+        }
+        BlockFormat format = opaque && textureCompression == COMPRESSION_BC ? BLOCK_BC1 : chooseBlockFormat(pixels, width, height);
+        compressImage(pixels, width, height, format, wrap, image);
+        stbi_image_free(pixels);
+
+        std::string message = "Texture compression: encoded " + path + " as " + blockFormatName(image.format) + "\n";
+        if (!writeKtx2(compressedPath, image)) {
+            message += "Texture compression: failed to write " + compressedPath + "\n";
+        }
+        std::cout << message; // One write, so messages from different workers do not interleave
+    }
+    return true;
+}
+#pragma endregion
+#pragma region LOAD FUNCTIONS
+// How a texture is sampled; textures only share an array when this matches
+enum TextureSampling {
+    SAMPLING_REPEAT_MIPMAPPED,  // Ground, wheat and model textures: repeat, trilinear
+    SAMPLING_CLAMP_MIPMAPPED    // Sprites with a transparent background: clamp to edge, trilinear
+};
+
+// Where a loaded texture ended up: an array texture and a layer inside it
+struct Material {
+    GLuint arrayTexture = 0;
+    int layer = 0;
+};
+
+// Normalise a texture path so different spellings of the same file share a cache entry:
+// backslashes become slashes, "." segments are dropped and "dir/.." pairs collapse (case-folded on Windows)
+std::string canonicalTexturePath(const std::string& path) {
+    std::vector<std::string> segments;
+    std::string segment;
+    bool absolute = !path.empty() && (path[0] == '/' || path[0] == '\\');
+    for (size_t i = 0; i <= path.size(); i++) {
+        char c = i < path.size() ? path[i] : '/';
+        if (c != '/' && c != '\\') {
+#ifdef _WIN32
+            c = (char)std::tolower((unsigned char)c);
+#endif
+            segment += c;
+            continue;
+        }
+        if (segment == "..") {
+            if (!segments.empty() && segments.back() != "..") segments.pop_back();
+            else segments.push_back(segment);
+        }
+        else if (!segment.empty() && segment != ".") {
+            segments.push_back(segment);
+        }
+        segment.clear();
+    }
+
+    std::string canonical = absolute ? "/" : "";
+    for (size_t i = 0; i < segments.size(); i++) {
+        if (i > 0) canonical += '/';
+        canonical += segments[i];
+    }
+    return canonical;
+}
+
+// Collects decoded images and packs them into GL_TEXTURE_2D_ARRAY textures, one array per distinct
+// size, sampling mode and storage format (RGBA8, or BC1/BC3/BC7 blocks with their stored mip chain when
+// texture compression is on). Draws then select their texture with a layer
+// index instead of a bind, so draws using textures of the same group can be merged.
+// Images are registered first (load decodes on the worker pool) and uploaded on the GL thread once every
+// texture is known: all at once (build) or in bounded slices through the asset streamer (buildStreamed).
+// Until its layer has landed, a material resolves to a placeholder layer.
+// Textures are keyed by canonical path and sampling mode: registering the same file again returns the
+// existing material id and takes a reference instead of decoding and uploading another copy.
+// Registration is thread-safe (models may load on worker threads); build and destroy are GL-thread only.
+class TextureArrayLibrary {
+public:
+    // Cache statistics
+    unsigned int hits = 0;
+    unsigned int misses = 0;
+    size_t bytesSaved = 0;  // RGBA8 bytes not decoded and uploaded thanks to cache hits (known after build)
+    size_t textureBytes = 0;        // Video memory taken by the arrays (known after build)
+    size_t uncompressedBytes = 0;   // What the same textures take as RGBA8
+    unsigned int compressedTextures = 0;
+
+    // Existing material id for a path and sampling mode (taking a reference), or -1 on a miss
+    int acquire(const std::string& path, TextureSampling sampling) {
+        std::lock_guard<std::mutex> lock(mutex);
+        return acquireLocked(path, sampling);
+    }
+
+    // Drop a reference; an array texture is deleted once none of its layers is referenced
+    void release(int id) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (id < 0 || refCounts[id] == 0) {
+            return;
+        }
+        refCounts[id]--;
+        GLuint arrayTexture = materials[id].arrayTexture;
+        if (refCounts[id] > 0 || arrayTexture == 0) {
+            return;
+        }
+        for (size_t i = 0; i < materials.size(); i++) {
+            if (materials[i].arrayTexture == arrayTexture && refCounts[i] > 0) {
+                return;
+            }
+        }
+        glDeleteTextures(1, &arrayTexture);
+        arrays.erase(std::remove(arrays.begin(), arrays.end(), arrayTexture), arrays.end());
+        for (auto& material : materials) {
+            if (material.arrayTexture == arrayTexture) material.arrayTexture = 0;
+        }
+    }
+
+    // Register a decoded image (a cache miss) with one reference; returns the material id
+    int add(const std::string& path, TextureSampling sampling, unsigned char* pixels, int width, int height) {
+        std::lock_guard<std::mutex> lock(mutex);
+        return addLocked(path, sampling, pixels, width, height);
+    }
+
+    // Material id for an image file: the cached entry if the file is already registered, otherwise a new
+    // entry loaded on the worker pool: its KTX2 blocks when texture compression is on, else the image
+    // decoded as RGBA8. A failed load becomes a 1x1 black texel, which matches what the old incomplete
+    // texture object sampled as.
+    int load(const std::string& path, TextureSampling sampling, WorkerPool& decoder) {
+        std::lock_guard<std::mutex> lock(mutex);
+        int cached = acquireLocked(path, sampling);
+        if (cached >= 0) {
+            return cached;
+        }
+        int id = addLocked(path, sampling, nullptr, 0, 0);
+        PendingImage* image = &pending.back(); // Stable: pending is a deque and only grows until build
+        decoder.submit([image]() {
+            PROFILE_ZONE("decodeTexture");
+            if (loadCompressedImage(image->path, image->sampling == SAMPLING_REPEAT_MIPMAPPED, false, image->compressed)) {
+                image->width = image->compressed.width;
+                image->height = image->compressed.height;
+                image->decoded.store(true, std::memory_order_release);
+                return;
+            }
+            int nrChannels;
+            image->pixels = stbi_load(image->path.c_str(), &image->width, &image->height, &nrChannels, STBI_rgb_alpha);
+            if (!image->pixels) {
+                std::string message = "Failed to load texture: " + image->path + "\nSTB Reason: " + stbi_failure_reason() + "\n";
+                std::cerr << message; // One write, so messages from different workers do not interleave
+                image->width = image->height = 1;
+                image->pixels = allocateBlackTexel();
+            }
+            buildMipChain(image->pixels, image->width, image->height, image->sampling == SAMPLING_REPEAT_MIPMAPPED, image->mipLevels);
+            image->decoded.store(true, std::memory_order_release);
+        });
+        return id;
+    }
+
+    // True once every registered image has been decoded (buildStreamed may be called)
+    bool decoded() {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (const auto& image : pending) {
+            if (!image.decoded.load(std::memory_order_acquire)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Waits for outstanding decodes, then uploads every registered image at once
+    void build(WorkerPool& decoder) {
+        decoder.wait();
+        allocateArrays();
+        for (auto& image : pending) {
+            const Material& material = materials[image.materialID];
+            glBindTexture(GL_TEXTURE_2D_ARRAY, material.arrayTexture);
+            const CompressedImage& compressed = image.compressed;
+            if (compressed.format != BLOCK_NONE) {
+                for (size_t level = 0; level < compressed.levels.size(); level++) {
+                    glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, (GLint)level, 0, 0, material.layer,
+                        mipDimension(compressed.width, (int)level), mipDimension(compressed.height, (int)level), 1,
+                        blockGLFormat(compressed.format), (GLsizei)compressed.levels[level].size(), compressed.levels[level].data());
+                }
+            }
+            else {
+                for (size_t level = 0; level <= image.mipLevels.size(); level++) {
+                    glTexSubImage3D(GL_TEXTURE_2D_ARRAY, (GLint)level, 0, 0, material.layer, mipDimension(image.width, (int)level),
+                        mipDimension(image.height, (int)level), 1, GL_RGBA, GL_UNSIGNED_BYTE, image.levelPixels(level));
+                }
+            }
+            layerUploaded(image);
+        }
+        pending.clear();
+        printStats();
+    }
+
+    // Queue every registered image on the streamer; each material switches from its placeholder as soon as
+    // its own layer has been uploaded. Call once decoded() is true.
+    void buildStreamed(AssetStreamer& streamer) {
+        allocateArrays();
+        layersInFlight = (int)pending.size();
+        for (auto& image : pending) {
+            PendingImage* source = &image;
+            const Material& material = materials[image.materialID];
+            std::function<void()> onDone = [this, source]() {
+                layerUploaded(*source);
+                if (--layersInFlight == 0) {
+                    pending.clear();
+                }
+            };
+            // Every level of the layer is queued; the layer counts as uploaded once the last one lands
+            const CompressedImage& compressed = image.compressed;
+            if (compressed.format == BLOCK_NONE) {
+                for (size_t level = 0; level <= image.mipLevels.size(); level++) {
+                    streamer.queueImage(GL_TEXTURE_2D_ARRAY, material.arrayTexture, GL_TEXTURE_2D_ARRAY, material.layer, (int)level,
+                        mipDimension(image.width, (int)level), mipDimension(image.height, (int)level), GL_RGBA, 4, image.levelPixels(level),
+                        level == image.mipLevels.size() ? onDone : std::function<void()>());
+                }
+                continue;
+            }
+            for (size_t level = 0; level < compressed.levels.size(); level++) {
+                streamer.queueCompressedImage(GL_TEXTURE_2D_ARRAY, material.arrayTexture, GL_TEXTURE_2D_ARRAY, material.layer, (int)level,
+                    mipDimension(compressed.width, (int)level), mipDimension(compressed.height, (int)level),
+                    blockGLFormat(compressed.format), blockBytes(compressed.format), compressed.levels[level].data(),
+                    level + 1 == compressed.levels.size() ? onDone : std::function<void()>());
+            }
+        }
+        printStats();
+    }
+
+    // The material of a texture, or a placeholder layer while its upload is still outstanding
+    Material material(int id) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (ready[id]) {
+            return materials[id];
+        }
+        Material placeholder;
+        placeholder.arrayTexture = placeholderArray;
+        placeholder.layer = samplings[id] == SAMPLING_CLAMP_MIPMAPPED ? 1 : 0;
+        return placeholder;
+    }
+
+    // The array and layer assigned to a texture by build, whether or not its pixels have landed yet
+    Material storage(int id) {
+        std::lock_guard<std::mutex> lock(mutex);
+        return materials[id];
+    }
+
+    bool isReady(int id) {
+        std::lock_guard<std::mutex> lock(mutex);
+        return ready[id] != 0;
+    }
+
+    std::string path(int id) {
+        std::lock_guard<std::mutex> lock(mutex);
+        return paths[id];
+    }
+
+    // Two-layer placeholder array: opaque grey (layer 0) for regular textures, fully transparent (layer 1)
+    // for sprites, so nothing blocks the view before the real textures arrive
+    void createPlaceholders() {
+        const unsigned char texels[8] = { 128, 128, 128, 255, 0, 0, 0, 0 };
+        glGenTextures(1, &placeholderArray);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, placeholderArray);
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, 1, 1, 2, 0, GL_RGBA, GL_UNSIGNED_BYTE, texels);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    }
+
+    // Material for meshes without a diffuse map: a single black texel (registered on first use, before build)
+    int blackMaterial() {
+        if (blackMaterialID < 0) {
+            blackMaterialID = add("<black>", SAMPLING_REPEAT_MIPMAPPED, allocateBlackTexel(), 1, 1);
+        }
+        return blackMaterialID;
+    }
+
+    static unsigned char* allocateBlackTexel() {
+        unsigned char* texel = (unsigned char*)STBI_MALLOC(4);
+        texel[0] = texel[1] = texel[2] = 0;
+        texel[3] = 255;
+        return texel;
+    }
+
+    // Delete the remaining arrays; every owner should have released its materials by now
+    void destroy() {
+        unsigned int referenced = 0;
+        for (size_t i = 0; i < refCounts.size(); i++) {
+            if (refCounts[i] > 0 && (int)i != blackMaterialID) referenced++;
+        }
+        if (referenced > 0) {
+            std::cerr << "Texture library: " << referenced << " textures still referenced at shutdown" << std::endl;
+        }
+        if (!arrays.empty()) {
+            glDeleteTextures((GLsizei)arrays.size(), arrays.data());
+        }
+        if (placeholderArray) {
+            glDeleteTextures(1, &placeholderArray);
+        }
+    }
+
+private:
+    struct PendingImage {
+        int materialID = -1;
+        std::string path;
+        TextureSampling sampling = SAMPLING_REPEAT_MIPMAPPED;
+        unsigned char* pixels = nullptr;  // RGBA8, owned until its layer is uploaded
+        std::vector<std::vector<unsigned char>> mipLevels; // RGBA8 levels 1 and below, built with the pixels
+        CompressedImage compressed;       // Used instead of pixels when loaded block-compressed
+        int width = 0, height = 0;
+        int group = -1;                   // Index into arrayGroups once allocated
+        std::atomic<bool> decoded{ false };
+
+        const unsigned char* levelPixels(size_t level) const { return level == 0 ? pixels : mipLevels[level - 1].data(); }
+    };
+
+    // One array texture and how many of its layers are still waiting for their upload
+    struct ArrayGroup {
+        GLuint texture;
+        TextureSampling sampling;
+        int layersRemaining;
+        int storedLevels;   // Mip levels uploaded with each layer (1 for a 1x1 texture)
+    };
+
+    std::mutex mutex;
+    std::deque<PendingImage> pending;
+    std::vector<Material> materials;
+    std::vector<std::string> paths;  // Source path per material id
+    std::vector<std::string> keys;   // Canonical path + sampling mode per material id
+    std::vector<TextureSampling> samplings;
+    std::vector<unsigned int> refCounts;
+    std::vector<unsigned int> hitCounts;
+    std::vector<char> ready;         // Layer uploaded, so the material can be used
+    std::vector<GLuint> arrays;
+    std::vector<ArrayGroup> arrayGroups;
+    GLuint placeholderArray = 0;
+    int layersInFlight = 0;
+    int blackMaterialID = -1;
+
+    static std::string cacheKey(const std::string& path, TextureSampling sampling) {
+        return canonicalTexturePath(path) + (sampling == SAMPLING_CLAMP_MIPMAPPED ? "|clamp" : "|repeat");
+    }
+
+    int acquireLocked(const std::string& path, TextureSampling sampling) {
+        std::string key = cacheKey(path, sampling);
+        for (size_t i = 0; i < keys.size(); i++) {
+            if (keys[i] == key) {
+                refCounts[i]++;
+                hitCounts[i]++;
+                hits++;
+                return (int)i;
+            }
+        }
+        misses++;
+        return -1;
+    }
+
+    int addLocked(const std::string& path, TextureSampling sampling, unsigned char* pixels, int width, int height) {
+        pending.emplace_back();
+        PendingImage& image = pending.back();
+        image.materialID = (int)materials.size();
+        image.path = path;
+        image.sampling = sampling;
+        image.pixels = pixels;
+        image.width = width;
+        image.height = height;
+        image.decoded.store(pixels != nullptr);
+        materials.push_back(Material());
+        paths.push_back(path);
+        keys.push_back(cacheKey(path, sampling));
+        samplings.push_back(sampling);
+        refCounts.push_back(1);
+        hitCounts.push_back(0);
+        ready.push_back(0);
+        return (int)materials.size() - 1;
+    }
+
+    // Create one array per size and sampling (layers in registration order) and assign every pending image
+    // its array and layer. Arrays start without mipmaps so partially streamed arrays can already be sampled.
+    void allocateArrays() {
+        std::vector<std::vector<size_t>> groups;
+        for (size_t i = 0; i < pending.size(); i++) {
+            bytesSaved += (size_t)hitCounts[pending[i].materialID] * pending[i].width * pending[i].height * 4;
+
+            size_t g = 0;
+            for (; g < groups.size(); g++) {
+                const PendingImage& first = pending[groups[g][0]];
+                if (first.width == pending[i].width && first.height == pending[i].height && first.sampling == pending[i].sampling &&
+                    first.compressed.format == pending[i].compressed.format && first.compressed.levels.size() == pending[i].compressed.levels.size() &&
+                    first.mipLevels.size() == pending[i].mipLevels.size()) {
+                    break;
+                }
+            }
+            if (g == groups.size()) {
+                groups.push_back(std::vector<size_t>());
+            }
+            groups[g].push_back(i);
+        }
+
+        for (const auto& group : groups) {
+            const PendingImage& first = pending[group[0]];
+            ArrayGroup arrayGroup;
+            glGenTextures(1, &arrayGroup.texture);
+            arrayGroup.sampling = first.sampling;
+            arrayGroup.layersRemaining = (int)group.size();
+
+            glBindTexture(GL_TEXTURE_2D_ARRAY, arrayGroup.texture);
+            const CompressedImage& compressed = first.compressed;
+            GLsizei layers = (GLsizei)group.size();
+            size_t rgbaBytes = (size_t)first.width * first.height * 4 * layers;
+            uncompressedBytes += rgbaBytes + rgbaBytes / 3; // A full mip chain adds about a third
+            if (compressed.format != BLOCK_NONE) {
+                // Storage for every stored level; sampling stops at the last one
+                arrayGroup.storedLevels = (int)compressed.levels.size();
+                for (int level = 0; level < arrayGroup.storedLevels; level++) {
+                    GLsizei levelBytes = (GLsizei)(compressed.levels[level].size() * layers);
+                    glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, level, blockGLFormat(compressed.format), mipDimension(first.width, level),
+                        mipDimension(first.height, level), layers, 0, levelBytes, nullptr);
+                    textureBytes += levelBytes;
+                }
+                compressedTextures += (unsigned int)group.size();
+            }
+            else {
+                arrayGroup.storedLevels = 1 + (int)first.mipLevels.size();
+                for (int level = 0; level < arrayGroup.storedLevels; level++) {
+                    int levelWidth = mipDimension(first.width, level), levelHeight = mipDimension(first.height, level);
+                    glTexImage3D(GL_TEXTURE_2D_ARRAY, level, GL_RGBA8, levelWidth, levelHeight, layers, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+                    textureBytes += (size_t)levelWidth * levelHeight * 4 * layers;
+                }
+            }
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, arrayGroup.storedLevels - 1);
+            GLint wrap = first.sampling == SAMPLING_REPEAT_MIPMAPPED ? GL_REPEAT : GL_CLAMP_TO_EDGE;
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, wrap);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, wrap);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+            for (size_t layer = 0; layer < group.size(); layer++) {
+                PendingImage& image = pending[group[layer]];
+                image.group = (int)arrayGroups.size();
+                materials[image.materialID].arrayTexture = arrayGroup.texture;
+                materials[image.materialID].layer = (int)layer;
+            }
+            arrays.push_back(arrayGroup.texture);
+            arrayGroups.push_back(arrayGroup);
+        }
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    }
+
+    // Called once every level of an image's layer holds its pixels: frees them, marks the material ready and
+    // switches the array to trilinear filtering when it was the last layer outstanding
+    void layerUploaded(PendingImage& image) {
+        stbi_image_free(image.pixels);
+        image.pixels = nullptr;
+        std::vector<std::vector<unsigned char>>().swap(image.mipLevels);
+        std::vector<std::vector<unsigned char>>().swap(image.compressed.levels);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            ready[image.materialID] = 1;
+        }
+
+        ArrayGroup& group = arrayGroups[image.group];
+        if (--group.layersRemaining > 0 || group.storedLevels == 1) {
+            return;
+        }
+        glBindTexture(GL_TEXTURE_2D_ARRAY, group.texture);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    }
+
+    void printStats() const {
+        std::cout << "Texture arrays: " << materials.size() << " textures in " << arrays.size() << " arrays" << std::endl;
+        std::cout << "Texture cache: " << hits << " hits, " << misses << " misses, "
+            << bytesSaved / 1024 << " KB of decoding and upload saved" << std::endl;
+        std::cout << "Texture compression: " << compressedTextures << " of " << materials.size() << " textures block-compressed, "
+            << textureBytes / 1024 << " KB of video memory (" << uncompressedBytes / 1024 << " KB as RGBA8)" << std::endl;
+    }
+};
+
+TextureArrayLibrary textureLibrary;
+
+// Register an image with the texture library (decoded in the background), unless the library already holds it
+int registerTexture(const char* path, TextureSampling sampling) {
+    return textureLibrary.load(path, sampling, workerPool);
+}
+
+// Function to load a texture (returns a material id in the texture library)
+int loadTexture(const char* path) {
+    PROFILE_ZONE("loadTexture");
+    std::cout << "Loading texture: " << path << std::endl; // Debug log
+    return registerTexture(path, SAMPLING_REPEAT_MIPMAPPED);
+}
+
+// Function to load a texture with transparent background (returns a material id in the texture library)
+int loadTreeTexture(const char* filename) {
+    return registerTexture(filename, SAMPLING_CLAMP_MIPMAPPED);
+}
+
+// Drop the texture reference each mesh took when it was loaded
+void releaseMaterials(const std::vector<Mesh>& meshes) {
+    for (const auto& mesh : meshes) {
+        textureLibrary.release(mesh.getMaterialID());
+    }
+}
+
+// Skybox faces being decoded on the worker pool, then uploaded (all at once or through the streamer)
+struct CubemapImages {
+    struct Face {
+        unsigned char* data = nullptr;
+        int width = 0, height = 0, nrChannels = 0;
+        std::vector<std::vector<unsigned char>> mipLevels; // RGBA8 levels 1 and below
+        CompressedImage compressed;     // Used instead of data when loaded block-compressed
+    };
+    std::vector<std::string> paths;
+    std::vector<Face> faces;
+    std::atomic<int> decodesPending{ 0 };
+    int uploadsPending = 0;
+
+    bool decoded() const { return decodesPending.load(std::memory_order_acquire) == 0; }
+    bool uploaded() const { return decoded() && uploadsPending == 0; }
+};
+
+// Decode one face (or read its KTX2 file) and build its mip chain
+void decodeCubemapFace(CubemapImages& images, size_t i) {
+    PROFILE_ZONE("decodeCubemapFace");
+    CubemapImages::Face& face = images.faces[i];
+    if (!loadCompressedImage(images.paths[i], false, true, face.compressed)) {
+        face.data = stbi_load(images.paths[i].c_str(), &face.width, &face.height, &face.nrChannels, STBI_rgb_alpha);
+        if (face.data) {
+            buildMipChain(face.data, face.width, face.height, false, face.mipLevels);
+        }
+    }
+    images.decodesPending.fetch_sub(1, std::memory_order_release);
+}
+
+// Start decoding the six faces (and building their mip chains) in parallel; only the uploads run on the GL thread
+void decodeCubemap(const std::vector<std::string>& faces, CubemapImages& images) {
+    images.paths = faces;
+    images.faces.assign(faces.size(), CubemapImages::Face());
+    images.decodesPending.store((int)faces.size());
+    for (size_t i = 0; i < faces.size(); i++) {
+        CubemapImages* target = &images;
+        workerPool.submit([target, i]() { decodeCubemapFace(*target, i); });
+    }
+}
+
+// Create the cubemap, with every mip level, from decoded faces. With a streamer the face storage is allocated
+// now and the pixels follow in bounded slices (images.uploaded() turns true when they have all landed).
+unsigned int createCubemap(CubemapImages& images, AssetStreamer* streamer) {
+    // A cubemap is only complete when every face has the same internal format. If only some faces came from
+    // KTX2 files (the others missing or stale), decode those again so all six are uploaded as RGBA8.
+    bool mixedFormats = false;
+    for (const CubemapImages::Face& face : images.faces) {
+        mixedFormats = mixedFormats || face.compressed.format != images.faces[0].compressed.format;
+    }
+    if (mixedFormats) {
+        std::cout << "Cubemap: faces have different block formats, uploading them uncompressed" << std::endl;
+        for (size_t i = 0; i < images.faces.size(); i++) {
+            CubemapImages::Face& face = images.faces[i];
+            if (face.compressed.format != BLOCK_NONE) {
+                face.compressed = CompressedImage();
+                face.data = stbi_load(images.paths[i].c_str(), &face.width, &face.height, &face.nrChannels, STBI_rgb_alpha);
+                if (face.data) {
+                    buildMipChain(face.data, face.width, face.height, false, face.mipLevels);
+                }
+            }
+        }
+    }
+
+    unsigned int textureID;
+    glGenTextures(1, &textureID);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
+
+    int levelCount = 0; // Fewest levels of any face; sampling stops there so every face is complete
+    for (unsigned int i = 0; i < images.faces.size(); i++) {
+        CubemapImages::Face& face = images.faces[i];
+        unsigned char* data = face.data;
+        CompressedImage& compressed = face.compressed;
+        CubemapImages* target = &images;
+        if (compressed.format != BLOCK_NONE) {
+            GLenum format = blockGLFormat(compressed.format);
+            int faceLevels = (int)compressed.levels.size();
+            levelCount = levelCount == 0 ? faceLevels : std::min(levelCount, faceLevels);
+            for (int level = 0; level < faceLevels; level++) {
+                const std::vector<unsigned char>& blocks = compressed.levels[level];
+                int levelWidth = mipDimension(compressed.width, level), levelHeight = mipDimension(compressed.height, level);
+                glCompressedTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, level, format, levelWidth, levelHeight, 0,
+                    (GLsizei)blocks.size(), streamer ? nullptr : blocks.data());
+                if (streamer) {
+                    streamer->queueCompressedImage(GL_TEXTURE_CUBE_MAP, textureID, GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, level,
+                        levelWidth, levelHeight, format, blockBytes(compressed.format), blocks.data(),
+                        level + 1 < faceLevels ? std::function<void()>() : [target, i]() {
+                            std::vector<std::vector<unsigned char>>().swap(target->faces[i].compressed.levels);
+                            target->uploadsPending--;
+                        });
+                }
+            }
+            if (streamer) {
+                images.uploadsPending++;
+            }
+            else {
+                std::vector<std::vector<unsigned char>>().swap(compressed.levels);
+            }
+        }
+        else if (data) {
+            int faceLevels = 1 + (int)face.mipLevels.size();
+            levelCount = levelCount == 0 ? faceLevels : std::min(levelCount, faceLevels);
+            for (int level = 0; level < faceLevels; level++) {
+                const unsigned char* pixels = level == 0 ? data : face.mipLevels[level - 1].data();
+                int levelWidth = mipDimension(face.width, level), levelHeight = mipDimension(face.height, level);
+                glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, level, GL_RGBA, levelWidth, levelHeight, 0, GL_RGBA, GL_UNSIGNED_BYTE,
+                    streamer ? nullptr : pixels);
+                if (streamer) {
+                    streamer->queueImage(GL_TEXTURE_CUBE_MAP, textureID, GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, level,
+                        levelWidth, levelHeight, GL_RGBA, 4, pixels,
+                        level + 1 < faceLevels ? std::function<void()>() : [target, i, data]() {
+                            stbi_image_free(data);
+                            std::vector<std::vector<unsigned char>>().swap(target->faces[i].mipLevels);
+                            target->uploadsPending--;
+                        });
+                }
+            }
+            if (streamer) {
+                images.uploadsPending++;
+            }
+            else {
+                stbi_image_free(data);
+                std::vector<std::vector<unsigned char>>().swap(face.mipLevels);
+            }
+        }
+        else {
+            std::cout << "Cubemap texture failed to load at path: " << images.paths[i] << std::endl;
+            stbi_image_free(data);
+        }
+        face.data = nullptr;
+    }
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, std::max(levelCount, 1) - 1);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+
+    return textureID;
+}
+
+// Load images to skybox Cubemap. The faces are decoded with parallelFor, so this thread decodes them too and
+// never waits behind jobs queued earlier.
+unsigned int loadCubemap(std::vector<std::string> faces) {
+    PROFILE_ZONE("loadCubemap");
+    CubemapImages images;
+    images.paths = faces;
+    images.faces.assign(faces.size(), CubemapImages::Face());
+    images.decodesPending.store((int)faces.size());
+    workerPool.parallelFor(faces.size(), [&images](size_t i) { decodeCubemapFace(images, i); });
+    return createCubemap(images, nullptr);
+}
+
+// Single-colour cubemap shown until the real skybox has streamed in
+unsigned int createPlaceholderCubemap(const glm::vec3& color) {
+    const unsigned char texel[3] = { (unsigned char)(color.x * 255.0f), (unsigned char)(color.y * 255.0f), (unsigned char)(color.z * 255.0f) };
+    unsigned int textureID;
+    glGenTextures(1, &textureID);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    for (unsigned int i = 0; i < 6; i++) {
+        glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB, 1, 1, 0, GL_RGB, GL_UNSIGNED_BYTE, texel);
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+    return textureID;
+}
+#pragma endregion
+#pragma region Mesh Cache
+// Binary cache of processed models, written next to the source asset ("<model>.meshcache") after an
+// import and memory-mapped on later starts, so a warm start never parses the OBJ text.
+//
+// Layout: MeshCacheHeader, then the payload: a uint32 mesh count followed by, per mesh, a MeshCacheEntry,
+// its texture path (padded to 4 bytes), its vertices and its indices. The cache is rebuilt when the
+// version, the importer that wrote it, the source file's size or modification time, or the payload
+// checksum do not match.
+const uint32_t MESH_CACHE_VERSION = 4; // 2: optimized index and vertex order, 3: OBJ reader output (shared corners),
+                                       // 4: importer recorded in the header
+
+struct MeshCacheHeader {
+    char magic[4];          // "MSHC"
+    uint32_t version;
+    uint32_t loader;        // ModelLoader that produced the meshes
+    uint32_t reserved;
+    uint64_t sourceSize;
+    int64_t sourceTime;     // Modification time of the source model
+    uint64_t payloadSize;
+    uint64_t checksum;      // FNV-1a of the payload
+};
+
+struct MeshCacheEntry {
+    uint32_t vertexCount;
+    uint32_t indexCount;
+    uint32_t texturePathLength; // 0 if the mesh has no diffuse map
+    uint32_t reserved;
+    float boundsMin[3];
+    float boundsMax[3];
+};
+
+// Read-only memory mapping of a whole file
+class MappedFile {
+public:
+    bool open(const std::string& path) {
+#ifdef _WIN32
+        file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE) {
+            return false;
+        }
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+            close();
+            return false;
+        }
+        mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (!mapping) {
+            close();
+            return false;
+        }
+        bytes = (const unsigned char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        length = (size_t)fileSize.QuadPart;
+#else
+        fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat info;
+        if (fstat(fd, &info) != 0 || info.st_size == 0) {
+            close();
+            return false;
+        }
+        void* view = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        bytes = view == MAP_FAILED ? nullptr : (const unsigned char*)view;
+        length = (size_t)info.st_size;
+#endif
+        if (!bytes) {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    void close() {
+#ifdef _WIN32
+        if (bytes) UnmapViewOfFile(bytes);
+        if (mapping) CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+        mapping = nullptr;
+        file = INVALID_HANDLE_VALUE;
+#else
+        if (bytes) munmap((void*)bytes, length);
+        if (fd >= 0) ::close(fd);
+        fd = -1;
+#endif
+        bytes = nullptr;
+        length = 0;
+    }
+
+    ~MappedFile() { close(); }
+
+    const unsigned char* data() const { return bytes; }
+    size_t size() const { return length; }
+
+private:
+    const unsigned char* bytes = nullptr;
+    size_t length = 0;
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+#else
+    int fd = -1;
+#endif
+};
+
+uint64_t fnv1a64(const unsigned char* data, size_t size) {
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= data[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+// Size and modification time of the source model (false if it cannot be read)
+bool getSourceStamp(const std::string& path, uint64_t& size, int64_t& time) {
+#ifdef _WIN32
+    struct _stat64 info;
+    if (_stat64(path.c_str(), &info) != 0) return false;
+#else
+    struct stat info;
+    if (stat(path.c_str(), &info) != 0) return false;
+#endif
+    size = (uint64_t)info.st_size;
+    time = (int64_t)info.st_mtime;
+    return true;
+}
+
+std::string meshCachePath(const std::string& modelPath) {
+    return modelPath + ".meshcache";
+}
+
+// Load a model from its cache; false if there is no valid cache written by loader (the caller then imports)
+bool readMeshCache(const std::string& modelPath, ModelLoader loader, std::vector<Mesh>& meshes) {
+    PROFILE_ZONE("readMeshCache");
+    uint64_t sourceSize;
+    int64_t sourceTime;
+    if (!getSourceStamp(modelPath, sourceSize, sourceTime)) {
+        return false;
+    }
+
+    MappedFile file;
+    if (!file.open(meshCachePath(modelPath)) || file.size() < sizeof(MeshCacheHeader)) {
+        return false;
+    }
+    MeshCacheHeader header;
+    std::memcpy(&header, file.data(), sizeof(header));
+    const unsigned char* payload = file.data() + sizeof(MeshCacheHeader);
+    if (std::memcmp(header.magic, "MSHC", 4) != 0 || header.version != MESH_CACHE_VERSION ||
+        header.loader != (uint32_t)loader || header.sourceSize != sourceSize || header.sourceTime != sourceTime ||
+        header.payloadSize != file.size() - sizeof(MeshCacheHeader) ||
+        header.checksum != fnv1a64(payload, (size_t)header.payloadSize)) {
+        std::cout << "Mesh cache: stale or invalid cache for " << modelPath << std::endl;
+        return false;
+    }
+
+    // Every size read from the payload is checked against what is left of it before it is used
+    std::vector<Mesh> loaded;
+    const unsigned char* cursor = payload;
+    const unsigned char* payloadEnd = payload + header.payloadSize;
+    auto take = [&cursor, payloadEnd](uint64_t size) -> const unsigned char* {
+        if (size > (uint64_t)(payloadEnd - cursor)) {
+            return nullptr;
+        }
+        const unsigned char* data = cursor;
+        cursor += size;
+        return data;
+    };
+    auto reject = [&modelPath, &loaded]() {
+        releaseMaterials(loaded); // The meshes read so far are dropped with their textures
+        std::cout << "Mesh cache: malformed cache for " << modelPath << std::endl;
+        return false;
+    };
+
+    uint32_t meshCount;
+    const unsigned char* countData = take(sizeof(meshCount));
+    if (!countData) {
+        return reject();
+    }
+    std::memcpy(&meshCount, countData, sizeof(meshCount));
+    loaded.reserve(std::min<uint64_t>(meshCount, header.payloadSize / sizeof(MeshCacheEntry)));
+    for (uint32_t m = 0; m < meshCount; m++) {
+        MeshCacheEntry entry;
+        const unsigned char* entryData = take(sizeof(entry));
+        if (!entryData) {
+            return reject();
+        }
+        std::memcpy(&entry, entryData, sizeof(entry));
+
+        const unsigned char* pathData = take(((uint64_t)entry.texturePathLength + 3) & ~(uint64_t)3);
+        const Vertex* vertexData = pathData ? (const Vertex*)take((uint64_t)entry.vertexCount * sizeof(Vertex)) : nullptr;
+        const unsigned int* indexData = vertexData ? (const unsigned int*)take((uint64_t)entry.indexCount * sizeof(unsigned int)) : nullptr;
+        if (!indexData) {
+            return reject();
+        }
+        for (uint32_t i = 0; i < entry.indexCount; i++) {
+            if (indexData[i] >= entry.vertexCount) {
+                return reject();
+            }
+        }
+        std::string texturePath((const char*)pathData, entry.texturePathLength);
+
+        AABB bounds;
+        bounds.min = glm::vec3(entry.boundsMin[0], entry.boundsMin[1], entry.boundsMin[2]);
+        bounds.max = glm::vec3(entry.boundsMax[0], entry.boundsMax[1], entry.boundsMax[2]);
+        int materialID = texturePath.empty() ? -1 : loadTexture(texturePath.c_str());
+        loaded.emplace_back(std::vector<Vertex>(vertexData, vertexData + entry.vertexCount),
+            std::vector<unsigned int>(indexData, indexData + entry.indexCount), materialID, bounds);
+    }
+
+    meshes.insert(meshes.end(), std::make_move_iterator(loaded.begin()), std::make_move_iterator(loaded.end()));
+    std::cout << "Mesh cache: loaded " << meshCount << " meshes from " << meshCachePath(modelPath) << std::endl;
+    return true;
+}
+
+// Write the meshes just imported for modelPath (meshes[firstMesh..]) by loader to its cache
+void writeMeshCache(const std::string& modelPath, ModelLoader loader, const std::vector<Mesh>& meshes, size_t firstMesh) {
+    uint64_t sourceSize;
+    int64_t sourceTime;
+    if (!getSourceStamp(modelPath, sourceSize, sourceTime)) {
+        return;
+    }
+
+    std::vector<unsigned char> payload;
+    auto append = [&payload](const void* data, size_t size) {
+        const unsigned char* bytes = (const unsigned char*)data;
+        payload.insert(payload.end(), bytes, bytes + size);
+    };
+
+    uint32_t meshCount = (uint32_t)(meshes.size() - firstMesh);
+    append(&meshCount, sizeof(meshCount));
+    for (size_t m = firstMesh; m < meshes.size(); m++) {
+        const Mesh& mesh = meshes[m];
+        std::string texturePath = mesh.getMaterialID() >= 0 ? textureLibrary.path(mesh.getMaterialID()) : std::string();
+
+        MeshCacheEntry entry = {};
+        entry.vertexCount = (uint32_t)mesh.getVertices().size();
+        entry.indexCount = (uint32_t)mesh.getIndices().size();
+        entry.texturePathLength = (uint32_t)texturePath.size();
+        for (int i = 0; i < 3; i++) {
+            entry.boundsMin[i] = mesh.getBounds().min[i];
+            entry.boundsMax[i] = mesh.getBounds().max[i];
+        }
+        append(&entry, sizeof(entry));
+        append(texturePath.data(), texturePath.size());
+        payload.resize((payload.size() + 3) & ~(size_t)3, 0);
+        append(mesh.getVertices().data(), mesh.getVertices().size() * sizeof(Vertex));
+        append(mesh.getIndices().data(), mesh.getIndices().size() * sizeof(unsigned int));
+    }
+
+    MeshCacheHeader header;
+    std::memcpy(header.magic, "MSHC", 4);
+    header.version = MESH_CACHE_VERSION;
+    header.loader = (uint32_t)loader;
+    header.reserved = 0;
+    header.sourceSize = sourceSize;
+    header.sourceTime = sourceTime;
+    header.payloadSize = payload.size();
+    header.checksum = fnv1a64(payload.data(), payload.size());
+
+    std::ofstream out(meshCachePath(modelPath), std::ios::binary | std::ios::trunc);
+    out.write((const char*)&header, sizeof(header));
+    out.write((const char*)payload.data(), (std::streamsize)payload.size());
+    if (!out) {
+        std::cerr << "Mesh cache: failed to write " << meshCachePath(modelPath) << std::endl;
+        return;
+    }
+    std::cout << "Mesh cache: wrote " << meshCount << " meshes to " << meshCachePath(modelPath) << std::endl;
+}
+#pragma endregion
+#pragma region OBJ Loader
+// Dedicated reader for Wavefront OBJ/MTL, used instead of Assimp's general importer for .obj models.
+// The file is memory-mapped and split into line-aligned chunks that are parsed in parallel, in two passes:
+// the first counts each chunk's v/vt/vn lines so every chunk knows its attributes' global offsets (which
+// also resolves negative, relative indices), the second parses attributes straight into shared arrays and
+// faces into per-chunk triangle lists. The chunks are then joined in file order and split into one mesh
+// per object, group or material, like Assimp does. Faces are fan-triangulated, corners with the same
+// v/vt/vn triple share a vertex, texture coordinates are flipped vertically (as aiProcess_FlipUVs does) and
+// the result goes through optimizeMesh. Line ("l") and point elements are skipped.
+
+// Where a new mesh starts: an "o", "g" or "usemtl" statement before triangle firstTriangle
+struct ObjBoundary {
+    size_t firstTriangle;
+    bool material;          // usemtl (name is the material) rather than o/g
+    std::string name;
+};
+
+// What one chunk of the file contributes
+struct ObjChunk {
+    const char* begin = nullptr;
+    const char* end = nullptr;
+    size_t positionCount = 0, texCoordCount = 0, normalCount = 0;  // Lines of each kind (first pass)
+    size_t positionOffset = 0, texCoordOffset = 0, normalOffset = 0;
+    std::vector<int> corners;   // Triangle corners as v, vt, vn triples (0-based, -1 when absent)
+    std::vector<ObjBoundary> boundaries;
+    std::vector<std::string> materialLibraries;
+    bool failed = false;        // An index was out of range or malformed
+};
+
+static const char* skipObjSpaces(const char* p, const char* end) {
+    while (p < end && (*p == ' ' || *p == '\t')) p++;
+    return p;
+}
+
+static const char* nextObjLine(const char* p, const char* end) {
+    const void* newline = std::memchr(p, '\n', (size_t)(end - p));
+    return newline ? (const char*)newline + 1 : end;
+}
+
+// Decimal float without locale handling or allocation: sign, digits, fraction and exponent are accumulated
+// as an integer mantissa and a power of ten (accurate to a few ulp, plenty for model data)
+static const char* parseObjFloat(const char* p, const char* end, float& value) {
+    static const double powers[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+    p = skipObjSpaces(p, end);
+    bool negative = p < end && *p == '-';
+    if (p < end && (*p == '-' || *p == '+')) p++;
+
+    uint64_t mantissa = 0;
+    int exponent = 0;
+    int digits = 0;
+    for (; p < end && *p >= '0' && *p <= '9'; p++, digits++) {
+        if (mantissa < 100000000000000000ull) mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+        else exponent++;
+    }
+    if (p < end && *p == '.') {
+        for (p++; p < end && *p >= '0' && *p <= '9'; p++, digits++) {
+            if (mantissa < 100000000000000000ull) {
+                mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+                exponent--;
+            }
+        }
+    }
+    if (digits > 0 && p < end && (*p == 'e' || *p == 'E')) {
+        const char* q = p + 1;
+        bool negativeExponent = q < end && *q == '-';
+        if (q < end && (*q == '-' || *q == '+')) q++;
+        if (q < end && *q >= '0' && *q <= '9') {
+            int written = 0;
+            for (; q < end && *q >= '0' && *q <= '9'; q++) written = std::min(written * 10 + (*q - '0'), 1000);
+            exponent += negativeExponent ? -written : written;
+            p = q;
+        }
+    }
+
+    double result = (double)mantissa;
+    if (exponent > 0) result *= exponent <= 22 ? powers[exponent] : std::pow(10.0, exponent);
+    else if (exponent < 0) result /= -exponent <= 22 ? powers[-exponent] : std::pow(10.0, -exponent);
+    value = (float)(negative ? -result : result);
+    return p;
+}
+
+static const char* parseObjInt(const char* p, const char* end, long long& value, bool& present) {
+    bool negative = p < end && *p == '-';
+    if (p < end && (*p == '-' || *p == '+')) p++;
+    present = p < end && *p >= '0' && *p <= '9';
+    value = 0;
+    for (; p < end && *p >= '0' && *p <= '9'; p++) value = std::min(value * 10 + (*p - '0'), 1LL << 40);
+    if (negative) value = -value;
+    return p;
+}
+
+// 1-based OBJ index to a 0-based one below total, or a negative index relative to the defined count;
+// -2 if it is out of range
+static int resolveObjIndex(long long index, size_t defined, size_t total) {
+    long long resolved = index > 0 ? index - 1 : (long long)defined + index;
+    return resolved >= 0 && resolved < (long long)total ? (int)resolved : -2;
+}
+
+// The rest of the line after a keyword, without surrounding whitespace or the line break
+static std::string objLineArgument(const char* p, const char* end) {
+    p = skipObjSpaces(p, end);
+    const char* last = end;
+    while (last > p && (last[-1] == '\n' || last[-1] == '\r' || last[-1] == ' ' || last[-1] == '\t')) last--;
+    return std::string(p, last);
+}
+
+static bool objKeyword(const char* p, const char* end, const char* keyword, size_t length) {
+    return (size_t)(end - p) > length && std::memcmp(p, keyword, length) == 0 && (p[length] == ' ' || p[length] == '\t');
+}
+
+// First pass: count the attribute lines of a chunk
+static void countObjChunk(ObjChunk& chunk) {
+    for (const char* line = chunk.begin; line < chunk.end; line = nextObjLine(line, chunk.end)) {
+        const char* lineEnd = nextObjLine(line, chunk.end);
+        const char* p = skipObjSpaces(line, lineEnd);
+        if (lineEnd - p < 2 || p[0] != 'v') continue;
+        if (p[1] == ' ' || p[1] == '\t') chunk.positionCount++;
+        else if (objKeyword(p, lineEnd, "vt", 2)) chunk.texCoordCount++;
+        else if (objKeyword(p, lineEnd, "vn", 2)) chunk.normalCount++;
+    }
+}
+
+// Second pass: attributes go into the shared arrays at the chunk's offsets, faces into the chunk
+static void parseObjChunk(ObjChunk& chunk, std::vector<glm::vec3>& positions, std::vector<glm::vec2>& texCoords,
+    std::vector<glm::vec3>& normals) {
+    size_t position = chunk.positionOffset, texCoord = chunk.texCoordOffset, normal = chunk.normalOffset;
+    std::vector<int> face;
+    for (const char* line = chunk.begin; line < chunk.end && !chunk.failed; line = nextObjLine(line, chunk.end)) {
+        const char* lineEnd = nextObjLine(line, chunk.end);
+        const char* p = skipObjSpaces(line, lineEnd);
+        if (p == lineEnd || *p == '#') continue;
+
+        if (p[0] == 'v' && lineEnd - p > 1 && (p[1] == ' ' || p[1] == '\t')) {
+            glm::vec3& v = positions[position++];
+            p = parseObjFloat(p + 1, lineEnd, v.x);
+            p = parseObjFloat(p, lineEnd, v.y);
+            parseObjFloat(p, lineEnd, v.z);
+        }
+        else if (objKeyword(p, lineEnd, "vt", 2)) {
+            glm::vec2& t = texCoords[texCoord++];
+            p = parseObjFloat(p + 2, lineEnd, t.x);
+            parseObjFloat(p, lineEnd, t.y);
+            t.y = 1.0f - t.y;
+        }
+        else if (objKeyword(p, lineEnd, "vn", 2)) {
+            glm::vec3& n = normals[normal++];
+            p = parseObjFloat(p + 2, lineEnd, n.x);
+            p = parseObjFloat(p, lineEnd, n.y);
+            parseObjFloat(p, lineEnd, n.z);
+        }
+        else if (objKeyword(p, lineEnd, "f", 1)) {
+            // v, v/vt, v//vn or v/vt/vn per corner; attribute counts so far bound the valid indices
+            face.clear();
+            p++;
+            while (true) {
+                p = skipObjSpaces(p, lineEnd);
+                long long index;
+                bool present;
+                p = parseObjInt(p, lineEnd, index, present);
+                if (!present) break;
+                int corner[3] = { resolveObjIndex(index, position, positions.size()), -1, -1 };
+                for (int attribute = 1; attribute < 3 && p < lineEnd && *p == '/'; attribute++) {
+                    p = parseObjInt(p + 1, lineEnd, index, present);
+                    if (present) {
+                        corner[attribute] = attribute == 1 ? resolveObjIndex(index, texCoord, texCoords.size()) :
+                            resolveObjIndex(index, normal, normals.size());
+                    }
+                }
+                if (corner[0] < 0 || corner[1] == -2 || corner[2] == -2) {
+                    chunk.failed = true;
+                    break;
+                }
+                face.insert(face.end(), corner, corner + 3);
+            }
+            for (size_t i = 2; i < face.size() / 3; i++) {
+                chunk.corners.insert(chunk.corners.end(), face.begin(), face.begin() + 3);
+                chunk.corners.insert(chunk.corners.end(), face.begin() + (i - 1) * 3, face.begin() + (i + 1) * 3);
+            }
+        }
+        else if (objKeyword(p, lineEnd, "usemtl", 6)) {
+            chunk.boundaries.push_back({ chunk.corners.size() / 9, true, objLineArgument(p + 6, lineEnd) });
+        }
+        else if (objKeyword(p, lineEnd, "o", 1) || objKeyword(p, lineEnd, "g", 1)) {
+            chunk.boundaries.push_back({ chunk.corners.size() / 9, false, objLineArgument(p + 1, lineEnd) });
+        }
+        else if (objKeyword(p, lineEnd, "mtllib", 6)) {
+            chunk.materialLibraries.push_back(objLineArgument(p + 6, lineEnd));
+        }
+    }
+}
+
+// Diffuse texture (map_Kd) of every material in an MTL file
+static void readObjMaterials(const std::string& path, std::vector<std::pair<std::string, std::string>>& diffuseMaps) {
+    std::ifstream in(path, std::ios::binary);
+    std::string line, material;
+    while (std::getline(in, line)) {
+        const char* begin = line.c_str();
+        const char* end = begin + line.size();
+        const char* p = skipObjSpaces(begin, end);
+        if (objKeyword(p, end, "newmtl", 6)) {
+            material = objLineArgument(p + 6, end);
+            diffuseMaps.push_back(std::make_pair(material, std::string()));
+        }
+        else if (objKeyword(p, end, "map_Kd", 6) && !diffuseMaps.empty()) {
+            // With options such as "-s 1 1 1" in front, the file name is the last word
+            std::string argument = objLineArgument(p + 6, end);
+            if (!argument.empty() && argument[0] == '-') {
+                argument = argument.substr(argument.find_last_of(" \t") + 1);
+            }
+            diffuseMaps.back().second = argument;
+        }
+    }
+}
+
+// Build one mesh from a run of triangle corners (shared vertices for repeated v/vt/vn triples)
+static void buildObjMesh(const std::vector<int>& corners, size_t firstTriangle, size_t endTriangle, const std::vector<glm::vec3>& positions,
+    const std::vector<glm::vec2>& texCoords, const std::vector<glm::vec3>& normals, int materialID, std::vector<Mesh>& meshes) {
+    std::vector<Vertex> vertices;
+    std::vector<unsigned int> indices;
+    indices.reserve((endTriangle - firstTriangle) * 3);
+    std::unordered_map<uint64_t, unsigned int> vertexIndex;
+    vertexIndex.reserve((endTriangle - firstTriangle) * 2);
+    AABB bounds;
+    for (size_t c = firstTriangle * 3; c < endTriangle * 3; c++) {
+        const int* corner = &corners[c * 3];
+        uint64_t key = (uint64_t)corner[0] | ((uint64_t)(corner[1] + 1) << 21) | ((uint64_t)(corner[2] + 1) << 42);
+        auto inserted = vertexIndex.insert(std::make_pair(key, (unsigned int)vertices.size()));
+        if (inserted.second) {
+            Vertex vertex;
+            vertex.Position = positions[corner[0]];
+            vertex.Normal = corner[2] >= 0 ? normals[corner[2]] : glm::vec3(0.0f);
+            vertex.TexCoords = corner[1] >= 0 ? texCoords[corner[1]] : glm::vec2(0.0f);
+            bounds.expand(vertex.Position);
+            vertices.push_back(vertex);
+        }
+        indices.push_back(inserted.first->second);
+    }
+    optimizeMesh(vertices, indices);
+    meshes.emplace_back(std::move(vertices), std::move(indices), materialID, bounds);
+}
+
+// Load an OBJ model (appending its meshes); false, with meshes untouched, if the file cannot be read or parsed
+bool loadObj(const std::string& path, std::vector<Mesh>& meshes) {
+    PROFILE_ZONE("loadObj");
+    MappedFile file;
+    if (!file.open(path)) {
+        std::cerr << "OBJ loader: cannot open " << path << std::endl;
+        return false;
+    }
+    const char* text = (const char*)file.data();
+    const char* textEnd = text + file.size();
+
+    // Line-aligned chunks of at least 64 KB, about one per thread
+    size_t chunkCount = std::max((size_t)1, std::min((size_t)workerPool.size() + 1, file.size() / (64 * 1024)));
+    std::vector<ObjChunk> chunks(chunkCount);
+    const char* cursor = text;
+    for (size_t i = 0; i < chunkCount; i++) {
+        chunks[i].begin = cursor;
+        cursor = i + 1 == chunkCount ? textEnd : nextObjLine(std::min(textEnd, text + file.size() * (i + 1) / chunkCount), textEnd);
+        chunks[i].end = cursor;
+    }
+
+    workerPool.parallelFor(chunkCount, [&chunks](size_t i) { countObjChunk(chunks[i]); });
+    size_t positionCount = 0, texCoordCount = 0, normalCount = 0;
+    for (auto& chunk : chunks) {
+        chunk.positionOffset = positionCount;
+        chunk.texCoordOffset = texCoordCount;
+        chunk.normalOffset = normalCount;
+        positionCount += chunk.positionCount;
+        texCoordCount += chunk.texCoordCount;
+        normalCount += chunk.normalCount;
+    }
+    if (positionCount >= (1u << 21) || texCoordCount >= (1u << 21) - 1 || normalCount >= (1u << 21) - 1) {
+        std::cerr << "OBJ loader: " << path << " is too large for the vertex key" << std::endl;
+        return false;
+    }
+    std::vector<glm::vec3> positions(positionCount);
+    std::vector<glm::vec2> texCoords(texCoordCount);
+    std::vector<glm::vec3> normals(normalCount);
+    workerPool.parallelFor(chunkCount, [&](size_t i) { parseObjChunk(chunks[i], positions, texCoords, normals); });
+
+    // Join the chunks in file order
+    std::vector<int> corners;
+    std::vector<ObjBoundary> boundaries;
+    std::vector<std::string> materialLibraries;
+    size_t cornerCount = 0;
+    for (const auto& chunk : chunks) {
+        if (chunk.failed) {
+            std::cerr << "OBJ loader: invalid face in " << path << std::endl;
+            return false;
+        }
+        cornerCount += chunk.corners.size();
+    }
+    corners.reserve(cornerCount);
+    for (const auto& chunk : chunks) {
+        size_t firstTriangle = corners.size() / 9;
+        for (const auto& boundary : chunk.boundaries) {
+            boundaries.push_back({ firstTriangle + boundary.firstTriangle, boundary.material, boundary.name });
+        }
+        corners.insert(corners.end(), chunk.corners.begin(), chunk.corners.end());
+        materialLibraries.insert(materialLibraries.end(), chunk.materialLibraries.begin(), chunk.materialLibraries.end());
+    }
+
+    std::string directory = path.substr(0, path.find_last_of('/'));
+    std::vector<std::pair<std::string, std::string>> diffuseMaps;
+    for (const auto& library : materialLibraries) {
+        readObjMaterials(directory + "/" + library, diffuseMaps);
+    }
+    auto materialTexture = [&](const std::string& material) {
+        for (const auto& entry : diffuseMaps) {
+            if (entry.first == material && !entry.second.empty()) {
+                std::string fullPath = directory + "/" + entry.second;
+                return loadTexture(fullPath.c_str());
+            }
+        }
+        return -1;
+    };
+
+    // One mesh per run of triangles between boundaries (empty runs, such as a group with no faces, are dropped)
+    std::vector<Mesh> loaded;
+    size_t triangleCount = corners.size() / 9;
+    size_t runStart = 0;
+    std::string material;
+    for (size_t b = 0; b <= boundaries.size(); b++) {
+        size_t runEnd = b < boundaries.size() ? boundaries[b].firstTriangle : triangleCount;
+        if (runEnd > runStart) {
+            buildObjMesh(corners, runStart, runEnd, positions, texCoords, normals, materialTexture(material), loaded);
+            runStart = runEnd;
+        }
+        if (b < boundaries.size() && boundaries[b].material) {
+            material = boundaries[b].name;
+        }
+    }
+
+    meshes.insert(meshes.end(), std::make_move_iterator(loaded.begin()), std::make_move_iterator(loaded.end()));
+    std::cout << "OBJ loader: " << loaded.size() << " meshes, " << triangleCount << " triangles from " << path
+        << " (" << chunkCount << " chunks)" << std::endl;
+    return true;
+}
+#pragma endregion
+#pragma region Shaders
+// Shader code
+// Per-frame camera and fog state, shared by every program through one UBO binding point. compileShader adds
+// it to every stage, so it is written once here and must match the FrameData struct below.
+const char* frameDataBlockSource = R"(
+layout (std140) uniform FrameData {
+    mat4 view;
+    mat4 projection;
+    vec4 cameraPos; // Camera position (xyz)
+    vec4 fogColor;  // Fog color
+    vec4 fogRange;  // Scene fog start/end (xy), skybox fog start/end (zw)
+};
+)";
+
+const char* vertexShaderSource = R"(
+#version 330 core
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec2 aTexCoord;
+layout (location = 2) in vec3 aInstanceOffset; // Per-instance offset (stays (0,0,0) for non-instanced draws)
+
+struct DrawRecord {
+    mat4 model;
+    vec4 material; // x = texture array layer
+};
+
+#ifdef STATIC_BATCH
+// Static batch: the model matrix comes from the draw's record, selected by the per-instance draw ID
+layout (location = 3) in uint aDrawID;
+
+layout (std140) uniform DrawData {
+    DrawRecord draws[MAX_STATIC_DRAWS];
+};
+#else
+// Any other draw: its own record, bound by offset from the uniform ring buffer
+layout (std140) uniform ObjectData {
+    DrawRecord object;
+};
+#endif
+
+out vec2 TexCoord;
+out vec3 FragPos;
+flat out float TexLayer; // Layer of the texture array holding this draw's texture
+
+void main() {
+#ifdef STATIC_BATCH
+    mat4 model = draws[aDrawID].model;
+    TexLayer = draws[aDrawID].material.x;
+#else
+    mat4 model = object.model;
+    TexLayer = object.material.x;
+#endif
+    vec4 worldPos = model * vec4(aPos + aInstanceOffset, 1.0);
+    gl_Position = projection * view * worldPos;
+    TexCoord = aTexCoord;
+
+    FragPos = vec3(worldPos);
+}
+)";
+
+const char* fragmentShaderSource = R"(
+#version 330 core
+out vec4 FragColor;
+
+in vec2 TexCoord;
+flat in float TexLayer;
+
+in vec3 FragPos; // Pass the fragment position from the vertex shader
+
+uniform sampler2DArray texture1;
+
+void main() {
+    float fogStart = fogRange.x; // Fog start distance
+    float fogEnd = fogRange.y;   // Fog end distance
+
+    // Fetch texture color
+    vec4 texColor = texture(texture1, vec3(TexCoord, TexLayer));
+
+    // Skip fog blending for fully transparent pixels
+    if (texColor.a < 0.1) {
+        discard;
+    }
+    
+    // Calculate distance from camera to the fragment
+    float distance = length(cameraPos.xyz - FragPos);
+    
+    // Calculate fog factor (linear fade)
+    float fogFactor = clamp((fogEnd - distance) / (fogEnd - fogStart), 0.0, 1.0);
+    
+    // Blend the fog color with the texture color based on fog factor
+    vec4 color = mix(texColor, fogColor, fogFactor);
+
+    FragColor = color;
+}
+)";
+
+const char* skyboxVertexShaderSource = R"(
+#version 330 core
+layout (location = 0) in vec3 aPos;
+
+out vec3 TexCoords;
+
+void main() {
+    TexCoords = aPos;
+    mat4 skyboxView = mat4(mat3(view)); // Remove translation from view matrix
+    vec4 pos = projection * skyboxView * vec4(aPos, 1.0);
+    gl_Position = pos.xyww; // Keep depth at maximum to prevent z-fighting
+}
+)";
+
+const char* skyboxFragmentShaderSource = R"(
+#version 330 core
+out vec4 FragColor;
+
+in vec3 TexCoords;
+
+uniform samplerCube skybox;
+
+void main() {
+    float fogStart = fogRange.z; // Fog start distance
+    float fogEnd = fogRange.w;   // Fog end distance
+
+    // Sample the skybox texture
+    vec4 skyboxColor = texture(skybox, TexCoords);
+
+    // Calculate the distance from the camera to the "infinity"
+    // For a skybox, use a fixed distance to simulate infinity, e.g., fogEnd + buffer
+    float fogDistance = fogEnd + 10.0;
+
+    // Calculate fog factor (linear fade)
+    float fogFactor = clamp((fogEnd - fogDistance) / (fogEnd - fogStart), 0.0, 1.0);
+    fogFactor = pow(fogFactor, 2.0); // Exponential curve for denser fog
+
+    // Blend the fog color with the skybox color
+    vec4 color = mix(fogColor, skyboxColor, fogFactor);
+
+    FragColor = color;
+}
+)";
+
+
+#pragma endregion
+#pragma region Create Shader Program
+// Compile one shader stage; defines (e.g. "#define STATIC_BATCH\n") and then the FrameData block are inserted
+// right after the #version line
+GLuint compileShader(GLenum type, const char* source, const std::string& defines) {
+    std::string text(source);
+    size_t versionEnd = text.find('\n', text.find("#version"));
+    text.insert(versionEnd + 1, defines + frameDataBlockSource);
+    const char* textPtr = text.c_str();
+
+    GLuint shader = glCreateShader(type);
+    glShaderSource(shader, 1, &textPtr, nullptr);
+    glCompileShader(shader);
+    return shader;
+}
+
+// Compile and link shaders
+GLuint createShaderProgram(const char* vertexSource, const char* fragmentSource, const std::string& defines = "") {
+    PROFILE_ZONE("createShaderProgram");
+    GLuint vertexShader = compileShader(GL_VERTEX_SHADER, vertexSource, defines);
+    GLuint fragmentShader = compileShader(GL_FRAGMENT_SHADER, fragmentSource, defines);
+
+    GLuint shaderProgram = glCreateProgram();
+    glAttachShader(shaderProgram, vertexShader);
+    glAttachShader(shaderProgram, fragmentShader);
+    glLinkProgram(shaderProgram);
+
+    glDeleteShader(vertexShader);
+    glDeleteShader(fragmentShader);
+
+    return shaderProgram;
+}
+
+// Shader program wrapper. Per-frame and per-draw values reach the shaders through uniform blocks (FrameData,
+// DrawData, ObjectData), and the samplers keep their default texture unit 0, so no plain uniforms are set.
+class ShaderProgram {
+public:
+    ShaderProgram(const char* vertexSource, const char* fragmentSource, const std::string& defines = "") {
+        programID = createShaderProgram(vertexSource, fragmentSource, defines);
+    }
+
+    GLuint id() const { return programID; }
+
+    void use() const { glUseProgram(programID); }
+
+    // Attach a named uniform block to a UBO binding point (no-op if the block is not used by this program)
+    void bindUniformBlock(const char* blockName, GLuint bindingPoint) const {
+        GLuint blockIndex = glGetUniformBlockIndex(programID, blockName);
+        if (blockIndex != GL_INVALID_INDEX) {
+            glUniformBlockBinding(programID, blockIndex, bindingPoint);
+        }
+    }
+
+private:
+    GLuint programID;
+};
+#pragma endregion
+#pragma region Frame Uniform Block
+// CPU mirror of the std140 FrameData block (every member is 16-byte aligned, so no padding is needed)
+struct FrameData {
+    glm::mat4 view;
+    glm::mat4 projection;
+    glm::vec4 cameraPos;
+    glm::vec4 fogColor;
+    glm::vec4 fogRange; // Scene fog start/end, skybox fog start/end
+};
+static_assert(sizeof(FrameData) == 176, "FrameData must match the std140 layout of the shader block");
+
+// Per-draw record read by the vertex shader (std140: mat4 + vec4, 80-byte array stride). The static batch
+// keeps an array of them; every other draw gets its own record in the dynamic ring buffer.
+struct DrawRecord {
+    glm::mat4 model;
+    glm::vec4 material; // x = texture array layer of the draw
+};
+static_assert(sizeof(DrawRecord) == 80, "DrawRecord must match the std140 layout of the shader block");
+
+const GLuint FRAME_DATA_BINDING = 0;
+const GLuint OBJECT_DATA_BINDING = 2;
+
+// Ring of per-frame uniform data: FrameData and one DrawRecord per dynamic draw, written linearly each
+// frame and bound by offset, so no draw needs a glUniform call. The buffer is split into one region per
+// frame in flight; a fence per region guards reuse, so the CPU only waits if the GPU falls three frames behind.
+// With GL 4.4 / ARB_buffer_storage the buffer is mapped once (persistent + coherent) and written directly;
+// otherwise each frame's region is mapped unsynchronized in beginFrame() and unmapped in flush().
+class UniformRingBuffer {
+public:
+    static const int REGION_COUNT = 3;
+    static const int MAX_DRAWS_PER_FRAME = 255; // Plus one slot for FrameData
+
+    void create() {
+        persistent = GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage;
+
+        GLint alignment = 256;
+        glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+        this->alignment = alignment;
+        regionSize = alignUp((GLsizeiptr)sizeof(FrameData)) + alignUp((GLsizeiptr)sizeof(DrawRecord)) * MAX_DRAWS_PER_FRAME;
+
+        glGenBuffers(1, &bufferID);
+        glBindBuffer(GL_UNIFORM_BUFFER, bufferID);
+        if (persistent) {
+            const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            glBufferStorage(GL_UNIFORM_BUFFER, regionSize * REGION_COUNT, nullptr, flags);
+            mapped = (unsigned char*)glMapBufferRange(GL_UNIFORM_BUFFER, 0, regionSize * REGION_COUNT, flags);
+        }
+        else {
+            glBufferData(GL_UNIFORM_BUFFER, regionSize * REGION_COUNT, nullptr, GL_DYNAMIC_DRAW);
+        }
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
+
+    bool isPersistent() const { return persistent; }
+    GLuint id() const { return bufferID; }
+
+    // Start writing the next region; waits only if the GPU still reads it
+    void beginFrame() {
+        waitForRegion(current);
+        used = 0;
+        if (!persistent) {
+            glBindBuffer(GL_UNIFORM_BUFFER, bufferID);
+            mapped = (unsigned char*)glMapBufferRange(GL_UNIFORM_BUFFER, regionSize * current, regionSize,
+                GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_FLUSH_EXPLICIT_BIT);
+            glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        }
+    }
+
+    // Copy data into this frame's region; returns its buffer offset, or -1 if the region is full
+    GLintptr write(const void* data, GLsizeiptr size) {
+        GLsizeiptr stride = alignUp(size);
+        if (!mapped || used + stride > regionSize) {
+            if (!overflowReported) {
+                std::cerr << "Uniform ring buffer: frame region full, draws skipped" << std::endl;
+                overflowReported = true;
+            }
+            return -1;
+        }
+        GLintptr regionOffset = persistent ? regionSize * current : 0; // The fallback maps only this region
+        std::memcpy(mapped + regionOffset + used, data, size);
+        GLintptr offset = regionSize * current + used;
+        used += stride;
+        return offset;
+    }
+
+    // Write this frame's FrameData and bind it
+    void writeFrameData(const FrameData& data) {
+        GLintptr offset = write(&data, sizeof(FrameData));
+        if (offset >= 0) {
+            glBindBufferRange(GL_UNIFORM_BUFFER, FRAME_DATA_BINDING, bufferID, offset, sizeof(FrameData));
+        }
+    }
+
+    GLintptr writeDraw(const glm::mat4& model, int textureLayer) {
+        DrawRecord record;
+        record.model = model;
+        record.material = glm::vec4((float)textureLayer, 0.0f, 0.0f, 0.0f);
+        return write(&record, sizeof(DrawRecord));
+    }
+
+    // Make this frame's writes visible to the GPU; call before the draws that read them
+    void flush() {
+        if (persistent || !mapped) {
+            return; // Coherent mapping: nothing to do
+        }
+        glBindBuffer(GL_UNIFORM_BUFFER, bufferID);
+        glFlushMappedBufferRange(GL_UNIFORM_BUFFER, 0, used);
+        glUnmapBuffer(GL_UNIFORM_BUFFER);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        mapped = nullptr;
+    }
+
+    // Call after the frame's draws have been submitted
+    void endFrame() {
+        fences[current] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        current = (current + 1) % REGION_COUNT;
+    }
+
+    void destroy() {
+        for (int i = 0; i < REGION_COUNT; i++) {
+            if (fences[i]) glDeleteSync(fences[i]);
+            fences[i] = nullptr;
+        }
+        if (persistent && mapped) {
+            glBindBuffer(GL_UNIFORM_BUFFER, bufferID);
+            glUnmapBuffer(GL_UNIFORM_BUFFER);
+            glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        }
+        mapped = nullptr;
+        glDeleteBuffers(1, &bufferID);
+    }
+
+private:
+    GLuint bufferID = 0;
+    GLsizeiptr alignment = 256;
+    GLsizeiptr regionSize = 0;
+    GLsizeiptr used = 0;
+    unsigned char* mapped = nullptr;
+    bool persistent = false;
+    bool overflowReported = false;
+    int current = 0;
+    GLsync fences[REGION_COUNT] = {};
+
+    GLsizeiptr alignUp(GLsizeiptr size) const {
+        return (size + alignment - 1) / alignment * alignment;
+    }
+
+    void waitForRegion(int region) {
+        if (!fences[region]) {
+            return;
+        }
+        GLenum result = glClientWaitSync(fences[region], GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+        while (result == GL_TIMEOUT_EXPIRED) {
+            result = glClientWaitSync(fences[region], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000); // 1 ms
+        }
+        glDeleteSync(fences[region]);
+        fences[region] = nullptr;
+    }
+};
+#pragma endregion
+#pragma region Vertex Formats
+// GPU layouts for static mesh vertices. Meshes are imported as full-precision Vertex structs and packed
+// when the static batch is uploaded:
+//  FLOAT:          position float3, UV float2                                   (20 bytes)
+//  PACKED:         position unorm16x3 relative to the mesh bounds, UV half2     (12 bytes)
+//  PACKED_NORMALS: PACKED plus an octahedral snorm16x2 normal                   (16 bytes)
+// Packed positions are dequantized by a per-mesh matrix folded into the draw's model matrix, so the
+// shader is the same for every layout. The normal is stored for lighting but no current shader reads it.
+enum VertexFormat {
+    VERTEX_FORMAT_FLOAT,
+    VERTEX_FORMAT_PACKED,
+    VERTEX_FORMAT_PACKED_NORMALS
+};
+
+size_t vertexFormatStride(VertexFormat format) {
+    switch (format) {
+    case VERTEX_FORMAT_PACKED: return 12;
+    case VERTEX_FORMAT_PACKED_NORMALS: return 16;
+    default: return 20;
+    }
+}
+
+const char* vertexFormatName(VertexFormat format) {
+    switch (format) {
+    case VERTEX_FORMAT_PACKED: return "packed";
+    case VERTEX_FORMAT_PACKED_NORMALS: return "packed-normals";
+    default: return "float";
+    }
+}
+
+// Unit vector onto the [-1, 1]^2 octahedron map
+glm::vec2 octahedralEncode(const glm::vec3& normal) {
+    float sum = std::abs(normal.x) + std::abs(normal.y) + std::abs(normal.z);
+    if (sum == 0.0f) {
+        return glm::vec2(0.0f, 0.0f);
+    }
+    glm::vec2 encoded(normal.x / sum, normal.y / sum);
+    if (normal.z < 0.0f) {
+        // Fold the lower hemisphere over the diagonals
+        glm::vec2 folded((1.0f - std::abs(encoded.y)) * (encoded.x >= 0.0f ? 1.0f : -1.0f),
+            (1.0f - std::abs(encoded.x)) * (encoded.y >= 0.0f ? 1.0f : -1.0f));
+        encoded = folded;
+    }
+    return encoded;
+}
+
+// Append count vertices in the given layout to out. Returns the matrix that maps the stored positions
+// back to mesh space (identity for FLOAT).
+glm::mat4 packVertices(const Vertex* vertices, size_t count, const AABB& bounds, VertexFormat format, std::vector<unsigned char>& out) {
+    size_t stride = vertexFormatStride(format);
+    size_t start = out.size();
+    out.resize(start + count * stride, 0);
+    unsigned char* dst = out.data() + start;
+
+    if (format == VERTEX_FORMAT_FLOAT) {
+        for (size_t i = 0; i < count; i++, dst += stride) {
+            std::memcpy(dst, &vertices[i].Position, 3 * sizeof(float));
+            std::memcpy(dst + 12, &vertices[i].TexCoords, 2 * sizeof(float));
+        }
+        return glm::mat4(1.0f);
+    }
+
+    glm::vec3 origin = bounds.isEmpty() ? glm::vec3(0.0f) : bounds.min;
+    glm::vec3 extent = bounds.isEmpty() ? glm::vec3(1.0f) : bounds.max - bounds.min;
+    for (int axis = 0; axis < 3; axis++) {
+        if (extent[axis] <= 0.0f) extent[axis] = 1.0f; // Flat along this axis: any scale works
+    }
+    for (size_t i = 0; i < count; i++, dst += stride) {
+        uint16_t position[3];
+        for (int axis = 0; axis < 3; axis++) {
+            position[axis] = glm::packUnorm1x16((vertices[i].Position[axis] - origin[axis]) / extent[axis]);
+        }
+        uint16_t uv[2] = { glm::packHalf1x16(vertices[i].TexCoords.x), glm::packHalf1x16(vertices[i].TexCoords.y) };
+        std::memcpy(dst, position, sizeof(position)); // Bytes 6-7 stay zero (padding)
+        std::memcpy(dst + 8, uv, sizeof(uv));
+        if (format == VERTEX_FORMAT_PACKED_NORMALS) {
+            glm::vec2 octahedral = octahedralEncode(vertices[i].Normal);
+            int16_t normal[2] = { (int16_t)glm::packSnorm1x16(octahedral.x), (int16_t)glm::packSnorm1x16(octahedral.y) };
+            std::memcpy(dst + 12, normal, sizeof(normal));
+        }
+    }
+    return glm::scale(glm::translate(glm::mat4(1.0f), origin), extent);
+}
+
+// Point attributes 0 (position) and 1 (UV) of the bound VAO at the bound vertex buffer
+void setupVertexFormat(VertexFormat format) {
+    GLsizei stride = (GLsizei)vertexFormatStride(format);
+    if (format == VERTEX_FORMAT_FLOAT) {
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (void*)0);
+        glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, stride, (void*)12);
+    }
+    else {
+        glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, stride, (void*)0);
+        glVertexAttribPointer(1, 2, GL_HALF_FLOAT, GL_FALSE, stride, (void*)8);
+    }
+    glEnableVertexAttribArray(0);
+    glEnableVertexAttribArray(1);
+}
+#pragma endregion
+#pragma region GPU Pass Timing
+// Scene passes timed on the GPU. Draws carry their pass; the timer stamps every change of pass.
+enum GpuPass {
+    GPU_PASS_SKYBOX,
+    GPU_PASS_GROUND,    // Road and grass planes
+    GPU_PASS_WHEAT,
+    GPU_PASS_HOUSES,
+    GPU_PASS_CASTLE,
+    GPU_PASS_TREES,
+    GPU_PASS_COUNT
+};
+
+const char* gpuPassName(int pass) {
+    static const char* names[GPU_PASS_COUNT] = { "skybox", "ground", "wheat", "houses", "castle", "trees" };
+    return names[pass];
+}
+
+// Per-pass GPU times from GL_TIMESTAMP queries. Each frame writes a timestamp whenever the pass of the
+// next draw differs from the last one, into its own slot of a ring of query sets; a slot is read back when
+// it comes round again, FRAMES_IN_FLIGHT frames later, and only if its last query is already available, so
+// the CPU never waits on the GPU (a frame whose results are late is dropped). The time between two stamps
+// is charged to the pass that started at the first. Averages cover the last AVERAGE_FRAMES resolved frames.
+class GpuPassTimer {
+public:
+    static const int FRAMES_IN_FLIGHT = 4;
+    static const int AVERAGE_FRAMES = 60;
+
+    unsigned int droppedFrames = 0; // Frames whose results were not ready when their slot was reused
+
+    // Needs GL 3.3 or ARB_timer_query; without them the timer stays disabled and costs nothing
+    void create() {
+        enabled = GLEW_VERSION_3_3 || GLEW_ARB_timer_query;
+    }
+
+    bool isEnabled() const { return enabled; }
+
+    void beginFrame() {
+        if (!enabled) return;
+        current = (current + 1) % FRAMES_IN_FLIGHT;
+        resolve(frames[current]);
+        frames[current].passes.clear();
+        currentPass = -1;
+    }
+
+    // Stamp the start of a pass (-1 ends the current one); repeated calls for the same pass are free
+    void mark(int pass) {
+        if (!enabled || pass == currentPass) return;
+        Frame& frame = frames[current];
+        if (frame.passes.size() == frame.queries.size()) {
+            GLuint query;
+            glGenQueries(1, &query);
+            frame.queries.push_back(query);
+        }
+        glQueryCounter(frame.queries[frame.passes.size()], GL_TIMESTAMP);
+        frame.passes.push_back(pass);
+        currentPass = pass;
+    }
+
+    void endFrame() {
+        mark(-1);
+    }
+
+    // Rolling average in milliseconds over the resolved frames kept
+    double average(int pass) const {
+        return historyCount > 0 ? historySum[pass] / historyCount : 0.0;
+    }
+
+    void destroy() {
+        for (Frame& frame : frames) {
+            if (!frame.queries.empty()) {
+                glDeleteQueries((GLsizei)frame.queries.size(), frame.queries.data());
+            }
+            frame.queries.clear();
+            frame.passes.clear();
+        }
+        enabled = false;
+    }
+
+private:
+    struct Frame {
+        std::vector<GLuint> queries;    // Grown on demand, reused every time the slot comes round
+        std::vector<int> passes;        // Pass starting at each query written this frame (-1: none)
+    };
+
+    Frame frames[FRAMES_IN_FLIGHT];
+    int current = 0;
+    int currentPass = -1;
+    bool enabled = false;
+    double history[AVERAGE_FRAMES][GPU_PASS_COUNT] = {};
+    double historySum[GPU_PASS_COUNT] = {};
+    int historyCount = 0;
+    int historyNext = 0;
+
+    // Fold a finished slot into the averages if its results have arrived (stamps complete in order)
+    void resolve(const Frame& frame) {
+        if (frame.passes.size() < 2) {
+            return;
+        }
+        GLuint available = 0;
+        glGetQueryObjectuiv(frame.queries[frame.passes.size() - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) {
+            droppedFrames++;
+            return;
+        }
+
+        double passMs[GPU_PASS_COUNT] = {};
+        GLuint64 previous = 0;
+        for (size_t i = 0; i < frame.passes.size(); i++) {
+            GLuint64 timestamp = 0;
+            glGetQueryObjectui64v(frame.queries[i], GL_QUERY_RESULT, &timestamp);
+            if (i > 0 && frame.passes[i - 1] >= 0) {
+                passMs[frame.passes[i - 1]] += (double)(timestamp - previous) * 1e-6;
+            }
+            previous = timestamp;
+        }
+
+        for (int pass = 0; pass < GPU_PASS_COUNT; pass++) {
+            historySum[pass] += passMs[pass] - history[historyNext][pass];
+            history[historyNext][pass] = passMs[pass];
+        }
+        historyNext = (historyNext + 1) % AVERAGE_FRAMES;
+        historyCount = std::min(historyCount + 1, AVERAGE_FRAMES);
+    }
+};
+#pragma endregion
+#pragma region Static Batch
+const GLuint DRAW_DATA_BINDING = 1;
+const int MAX_STATIC_DRAWS = 128; // 128 * 80 bytes stays under the 16 KB minimum UBO size
+
+// Layout of one glMultiDrawElementsIndirect command
+struct DrawElementsIndirectCommand {
+    GLuint count;
+    GLuint instanceCount;
+    GLuint firstIndex;
+    GLint baseVertex;
+    GLuint baseInstance;
+};
+
+// All static model geometry packed into one vertex buffer and one index buffer. Each draw (a mesh placed
+// by a scene node) is one indirect command; draws whose textures live in the same texture array form one
+// material pass (each draw picks its layer from its DrawRecord) that is issued
+// with a single glMultiDrawElementsIndirect. The shader finds its DrawRecord through a per-instance draw ID
+// attribute: every command draws one instance with baseInstance = its draw index.
+// Without multi-draw indirect support the passes fall back to one glDrawElementsBaseVertex per draw.
+// Vertices are stored in the selected VertexFormat, and indices (local to each mesh) are 16-bit whenever
+// every mesh has at most 65536 vertices.
+class StaticBatch {
+public:
+    struct Pass {
+        GLuint texture;     // Texture array shared by the pass
+        int gpuPass;        // GpuPass its draws are timed under
+        int firstDraw;
+        int drawCount;
+    };
+
+    // Append a mesh's geometry; the same geometry can be placed by several draws
+    int addMesh(const Mesh& mesh) {
+        Geometry geometry;
+        geometry.baseVertex = (GLint)vertices.size();
+        geometry.vertexCount = (GLuint)mesh.getVertices().size();
+        geometry.firstIndex = (GLuint)indices.size();
+        geometry.indexCount = (GLuint)mesh.getIndices().size();
+        geometry.materialID = mesh.getMaterialID() >= 0 ? mesh.getMaterialID() : textureLibrary.blackMaterial();
+        geometry.bounds = mesh.getBounds();
+        vertices.insert(vertices.end(), mesh.getVertices().begin(), mesh.getVertices().end());
+        indices.insert(indices.end(), mesh.getIndices().begin(), mesh.getIndices().end());
+        geometries.push_back(geometry);
+        return (int)geometries.size() - 1;
+    }
+
+    // Place every mesh of a model with the transform of a scene node; returns the model's first geometry index
+    int addModel(const std::vector<Mesh>& meshes, int node, GpuPass gpuPass) {
+        int firstGeometry = (int)geometries.size();
+        for (const auto& mesh : meshes) {
+            addMesh(mesh);
+        }
+        addModelInstance(firstGeometry, (int)meshes.size(), node, gpuPass);
+        return firstGeometry;
+    }
+
+    // Place an already added model again; its geometry is shared, only the draws are new
+    void addModelInstance(int firstGeometry, int meshCount, int node, GpuPass gpuPass) {
+        for (int i = 0; i < meshCount; i++) {
+            Draw draw;
+            draw.geometry = firstGeometry + i;
+            draw.node = node;
+            draw.gpuPass = gpuPass;
+            draws.push_back(draw);
+        }
+    }
+
+    // When set, the CPU copies of the geometry are freed as soon as the GPU buffers hold them
+    void setReleaseCpuData(bool release) { releaseCpuData = release; }
+
+    // CPU memory still held for geometry (imported vertices and indices plus their packed GPU layouts)
+    size_t residentCpuBytes() const {
+        return vertices.capacity() * sizeof(Vertex) + indices.capacity() * sizeof(unsigned int) +
+            vertexData.capacity() + indexData.capacity();
+    }
+
+    // Create the GPU buffers (after the texture library is built). Draws are grouped by texture array (then by
+    // GPU timing pass, so models sharing an array are still timed apart) so each material pass is a contiguous
+    // range. With a streamer the vertex and index data are written in per-frame slices, and the batch is drawn
+    // once they and its textures have landed (isReady).
+    void upload(bool useMultiDrawIndirect, VertexFormat format, AssetStreamer* streamer = nullptr) {
+        multiDrawIndirect = useMultiDrawIndirect;
+        packGeometry(format);
+        if (draws.size() > (size_t)MAX_STATIC_DRAWS) {
+            std::cerr << "Static batch: " << draws.size() << " draws, only the first " << MAX_STATIC_DRAWS << " are kept" << std::endl;
+            draws.resize(MAX_STATIC_DRAWS);
+        }
+        std::stable_sort(draws.begin(), draws.end(), [this](const Draw& a, const Draw& b) {
+            GLuint textureA = textureLibrary.storage(geometries[a.geometry].materialID).arrayTexture;
+            GLuint textureB = textureLibrary.storage(geometries[b.geometry].materialID).arrayTexture;
+            return textureA != textureB ? textureA < textureB : a.gpuPass < b.gpuPass;
+        });
+
+        commands.resize(draws.size());
+        for (size_t i = 0; i < draws.size(); i++) {
+            const Geometry& geometry = geometries[draws[i].geometry];
+            const Material& material = textureLibrary.storage(geometry.materialID);
+            commands[i].count = geometry.indexCount;
+            commands[i].instanceCount = 1;
+            commands[i].firstIndex = geometry.firstIndex;
+            commands[i].baseVertex = geometry.baseVertex;
+            commands[i].baseInstance = (GLuint)i; // Draw ID seen by the shader
+
+            if (passes.empty() || passes.back().texture != material.arrayTexture || passes.back().gpuPass != draws[i].gpuPass) {
+                Pass pass;
+                pass.texture = material.arrayTexture;
+                pass.gpuPass = draws[i].gpuPass;
+                pass.firstDraw = (int)i;
+                pass.drawCount = 0;
+                passes.push_back(pass);
+            }
+            passes.back().drawCount++;
+        }
+
+        glGenVertexArrays(1, &VAO);
+        glGenBuffers(1, &VBO);
+        glGenBuffers(1, &EBO);
+        glGenBuffers(1, &drawIDBuffer);
+        glGenBuffers(1, &indirectBuffer);
+        glGenBuffers(1, &drawDataBuffer);
+
+        glBindVertexArray(VAO);
+        glBindBuffer(GL_ARRAY_BUFFER, VBO);
+        glBufferData(GL_ARRAY_BUFFER, vertexData.size(), streamer ? nullptr : vertexData.data(), GL_STATIC_DRAW);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexData.size(), streamer ? nullptr : indexData.data(), GL_STATIC_DRAW);
+        if (streamer) {
+            uploadsPending = 2;
+            streamer->queueBuffer(VBO, vertexData.data(), vertexData.size(), [this]() { uploadsPending--; });
+            streamer->queueBuffer(EBO, indexData.data(), indexData.size(), [this]() { uploadsPending--; });
+        }
+        else if (releaseCpuData) {
+            freeCpuGeometry();
+        }
+
+        // Position and texture coord attributes
+        setupVertexFormat(format);
+
+        // Draw ID attribute: 0..N-1, advanced per instance, so baseInstance selects the draw's record.
+        // The fallback path leaves it disabled and sets the constant attribute value before each draw instead.
+        std::vector<GLuint> drawIDs(MAX_STATIC_DRAWS);
+        for (int i = 0; i < MAX_STATIC_DRAWS; i++) {
+            drawIDs[i] = (GLuint)i;
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, drawIDBuffer);
+        glBufferData(GL_ARRAY_BUFFER, drawIDs.size() * sizeof(GLuint), drawIDs.data(), GL_STATIC_DRAW);
+        glVertexAttribIPointer(3, 1, GL_UNSIGNED_INT, sizeof(GLuint), (void*)0);
+        glVertexAttribDivisor(3, 1);
+        if (multiDrawIndirect) {
+            glEnableVertexAttribArray(3);
+        }
+        glBindVertexArray(0);
+
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+        glBufferData(GL_DRAW_INDIRECT_BUFFER, commands.size() * sizeof(DrawElementsIndirectCommand), commands.data(), GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+        // Per-draw records are filled by update() once the scene nodes have world matrices
+        records.resize(MAX_STATIC_DRAWS);
+        glBindBuffer(GL_UNIFORM_BUFFER, drawDataBuffer);
+        glBufferData(GL_UNIFORM_BUFFER, records.size() * sizeof(DrawRecord), nullptr, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        glBindBufferBase(GL_UNIFORM_BUFFER, DRAW_DATA_BINDING, drawDataBuffer);
+        refreshRecords = true;
+    }
+
+    // True once the buffers and every texture the batch uses hold their data
+    bool isReady() const { return ready; }
+
+    // Pull transforms from scene nodes that changed (none, once the static scene has settled).
+    // Right after upload every record is written, whether or not its node changed this frame.
+    void update(const SceneGraph& scene) {
+        if (VAO == 0) {
+            return;
+        }
+        if (!ready && uploadsPending == 0) {
+            if (releaseCpuData) {
+                freeCpuGeometry(); // Streamed uploads have finished reading the arrays
+            }
+            ready = true;
+            for (const auto& geometry : geometries) {
+                ready = ready && textureLibrary.isReady(geometry.materialID);
+            }
+        }
+
+        int firstChanged = -1, lastChanged = -1;
+        for (size_t i = 0; i < draws.size(); i++) {
+            Draw& draw = draws[i];
+            if (!refreshRecords && !scene.hasChanged(draw.node)) {
+                continue;
+            }
+            const Geometry& geometry = geometries[draw.geometry];
+            records[i].model = scene.world(draw.node) * geometry.dequantize;
+            records[i].material = glm::vec4((float)textureLibrary.storage(geometry.materialID).layer, 0.0f, 0.0f, 0.0f);
+            draw.worldBounds = transformAABB(geometry.bounds, scene.world(draw.node));
+
+            if (firstChanged < 0) firstChanged = (int)i;
+            lastChanged = (int)i;
+        }
+        if (firstChanged >= 0) {
+            glBindBuffer(GL_UNIFORM_BUFFER, drawDataBuffer);
+            glBufferSubData(GL_UNIFORM_BUFFER, firstChanged * sizeof(DrawRecord),
+                (lastChanged - firstChanged + 1) * sizeof(DrawRecord), &records[firstChanged]);
+            glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        }
+        refreshRecords = false;
+    }
+
+    // Per-draw frustum culling: culled draws keep their command but draw zero instances
+    void cull(Culler& culler) {
+        PROFILE_ZONE("StaticBatch::cull");
+        if (VAO == 0) {
+            return;
+        }
+        bool commandsChanged = false;
+        for (size_t i = 0; i < draws.size(); i++) {
+            GLuint instanceCount = culler.isVisible(draws[i].worldBounds) ? 1 : 0;
+            if (commands[i].instanceCount != instanceCount) {
+                commands[i].instanceCount = instanceCount;
+                commandsChanged = true;
+            }
+        }
+        if (commandsChanged) {
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+            glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, commands.size() * sizeof(DrawElementsIndirectCommand), commands.data());
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+        }
+    }
+
+    const std::vector<Pass>& getPasses() const { return passes; }
+    GLuint getVAO() const { return VAO; }
+
+    // World bounds of the visible draws of a pass (empty if the whole pass is culled)
+    AABB visibleBounds(int pass) const {
+        AABB bounds;
+        for (int i = passes[pass].firstDraw; i < passes[pass].firstDraw + passes[pass].drawCount; i++) {
+            if (commands[i].instanceCount > 0) {
+                bounds.expand(draws[i].worldBounds);
+            }
+        }
+        return bounds;
+    }
+
+    // Issue one material pass; the VAO, program and texture are already bound by the render queue
+    void drawPass(int pass) const {
+        const Pass& p = passes[pass];
+        if (multiDrawIndirect) {
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+            glMultiDrawElementsIndirect(GL_TRIANGLES, indexType,
+                (void*)(p.firstDraw * sizeof(DrawElementsIndirectCommand)), p.drawCount, 0);
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+            return;
+        }
+        for (int i = p.firstDraw; i < p.firstDraw + p.drawCount; i++) {
+            const DrawElementsIndirectCommand& cmd = commands[i];
+            if (cmd.instanceCount == 0) {
+                continue;
+            }
+            glVertexAttribI1ui(3, cmd.baseInstance);
+            glDrawElementsBaseVertex(GL_TRIANGLES, cmd.count, indexType, (void*)(cmd.firstIndex * indexSize()), cmd.baseVertex);
+        }
+    }
+
+    void destroy() {
+        glDeleteVertexArrays(1, &VAO);
+        GLuint buffers[] = { VBO, EBO, drawIDBuffer, indirectBuffer, drawDataBuffer };
+        glDeleteBuffers(5, buffers);
+    }
+
+private:
+    struct Geometry {
+        GLint baseVertex;
+        GLuint firstIndex;
+        GLuint indexCount;
+        GLuint vertexCount;
+        int materialID;
+        AABB bounds; // Local space
+        glm::mat4 dequantize = glm::mat4(1.0f); // Stored vertex positions -> local space
+    };
+    struct Draw {
+        int geometry;
+        int node;          // Scene node providing the model matrix
+        int gpuPass;
+        AABB worldBounds;
+    };
+
+    std::vector<Vertex> vertices;
+    std::vector<unsigned int> indices;
+    std::vector<unsigned char> vertexData;  // GPU layouts of vertices and indices, built by upload()
+    std::vector<unsigned char> indexData;
+    GLenum indexType = GL_UNSIGNED_INT;
+    std::vector<Geometry> geometries;
+    std::vector<Draw> draws;
+    std::vector<DrawElementsIndirectCommand> commands;
+    std::vector<DrawRecord> records;
+    std::vector<Pass> passes;
+    bool multiDrawIndirect = false;
+    bool refreshRecords = false;
+    bool releaseCpuData = false;
+    bool ready = false;
+    int uploadsPending = 0;     // Streamed buffer writes still outstanding
+    GLuint VAO = 0, VBO = 0, EBO = 0, drawIDBuffer = 0, indirectBuffer = 0, drawDataBuffer = 0;
+
+    size_t indexSize() const { return indexType == GL_UNSIGNED_SHORT ? sizeof(uint16_t) : sizeof(uint32_t); }
+
+    void freeCpuGeometry() {
+        std::vector<Vertex>().swap(vertices);
+        std::vector<unsigned int>().swap(indices);
+        std::vector<unsigned char>().swap(vertexData);
+        std::vector<unsigned char>().swap(indexData);
+    }
+
+    // Convert every geometry's vertices to the GPU layout and pick the narrowest index type
+    void packGeometry(VertexFormat format) {
+        vertexData.clear();
+        GLuint largestMesh = 0;
+        for (auto& geometry : geometries) {
+            geometry.dequantize = packVertices(vertices.data() + geometry.baseVertex, geometry.vertexCount, geometry.bounds, format, vertexData);
+            largestMesh = std::max(largestMesh, geometry.vertexCount);
+        }
+
+        // Indices are relative to each mesh's base vertex, so only the largest mesh decides the width
+        indexType = largestMesh <= 65536 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+        indexData.resize(indices.size() * indexSize());
+        if (indexType == GL_UNSIGNED_SHORT) {
+            uint16_t* dst = (uint16_t*)indexData.data();
+            for (size_t i = 0; i < indices.size(); i++) {
+                dst[i] = (uint16_t)indices[i];
+            }
+        }
+        else {
+            std::memcpy(indexData.data(), indices.data(), indexData.size());
+        }
+
+        std::cout << "Static batch: " << vertices.size() << " vertices as " << vertexFormatName(format) << " ("
+            << vertexData.size() / 1024 << " KB, " << vertices.size() * sizeof(Vertex) / 1024 << " KB imported), "
+            << indices.size() << " indices as " << indexSize() * 8 << "-bit (" << indexData.size() / 1024 << " KB)" << std::endl;
+    }
+};
+#pragma endregion
+#pragma region Render Queue
+// Draw layers, executed in this order. The layer occupies the top bits of the sort key.
+// The skybox goes after the opaques so it only shades pixels nothing else covered.
+enum RenderLayer {
+    LAYER_OPAQUE = 0,       // Regular geometry: depth test LESS with depth writes, roughly front-to-back
+    LAYER_SKYBOX = 1,       // Skybox: depth test LEQUAL, no depth writes
+    LAYER_TRANSPARENT = 2   // Alpha-blended sprites, back-to-front by camera distance
+};
+
+// Everything needed to issue one draw without touching the scene again
+struct DrawCommand {
+    ShaderProgram* program = nullptr;
+    GLuint drawDataBuffer = 0;          // Buffer holding the draw's DrawRecord (0 if the program reads none)
+    GLintptr drawDataOffset = 0;
+    GLuint vao = 0;
+    GLenum textureTarget = GL_TEXTURE_2D_ARRAY;
+    GLuint texture = 0;
+    GLenum mode = GL_TRIANGLES;
+    const StaticBatch* batch = nullptr; // Set for a static batch material pass (first = pass index)
+    GLint first = 0;
+    GLsizei count = 0;
+    GLsizei instanceCount = 0;          // 0 = not instanced
+    GLuint instanceBuffer = 0;          // Instanced draws re-point attribute 2 at instanceOffset in this buffer
+    GLintptr instanceOffset = 0;
+    int gpuPass = -1;                   // GpuPass the draw is timed under (-1: untimed)
+};
+
+// Per-frame draw list. Each submission becomes a 64-bit sort key plus an index into the command array;
+// the keys are radix sorted and execute() only touches GL state when it actually changes.
+//
+// Opaque key:      [63:62] layer | [61:56] depth bucket | [55:48] program | [47:36] texture | [35:24] VAO | [23:0] depth
+// Skybox key:      [63:62] layer | [29:0] sequence
+// Transparent key: [63:62] layer | [61:30] inverted distance | [29:0] sequence
+//
+// Opaque draws go near to far in coarse log-spaced buckets (for early-z rejection) and are grouped by
+// program, texture and VAO inside each bucket. Transparent draws are ordered far to near so blending is
+// correct from any camera position. State fields hold small dense ids assigned on first sight.
+class RenderQueue {
+public:
+    // State changes issued by the last execute()
+    unsigned int drawCount = 0;
+    unsigned int programChanges = 0;
+    unsigned int textureChanges = 0;
+    unsigned int vaoChanges = 0;
+
+    // Start a new frame; distances for depth ordering are measured from eye
+    void clear(const glm::vec3& eye) {
+        eyePos = eye;
+        commands.clear();
+        entries.clear();
+    }
+
+    // worldBounds is used for depth ordering (the skybox can pass an empty box)
+    void submit(RenderLayer layer, const DrawCommand& command, const AABB& worldBounds) {
+        uint64_t key = (uint64_t)layer << 62;
+        uint64_t sequence = (uint64_t)(commands.size() & 0x3FFFFFFF);
+
+        if (layer == LAYER_OPAQUE) {
+            // Distance to the nearest point of the box: large planes the camera stands on count as closest
+            float distance = worldBounds.isEmpty() ? 0.0f : glm::length(glm::clamp(eyePos, worldBounds.min, worldBounds.max) - eyePos);
+            uint64_t bucket = (uint64_t)std::min(63.0f, std::log2(1.0f + distance) * 8.0f);
+            key |= bucket << 56;
+            key |= (uint64_t)(denseId(programIds, command.program->id()) & 0xFF) << 48;
+            key |= (uint64_t)(denseId(textureIds, command.texture) & 0xFFF) << 36;
+            key |= (uint64_t)(denseId(vaoIds, command.vao) & 0xFFF) << 24;
+            key |= (uint64_t)(floatBits(distance) >> 8);
+        }
+        else if (layer == LAYER_TRANSPARENT) {
+            // Distance to the centre of the box, inverted so the furthest draw sorts first
+            float distance = worldBounds.isEmpty() ? 0.0f : glm::length((worldBounds.min + worldBounds.max) * 0.5f - eyePos);
+            key |= (uint64_t)(~floatBits(distance)) << 30;
+            key |= sequence;
+        }
+        else {
+            key |= sequence;
+        }
+
+        SortEntry entry;
+        entry.key = key;
+        entry.index = (uint32_t)commands.size();
+        entries.push_back(entry);
+        commands.push_back(command);
+    }
+
+    // LSD radix sort on the keys, one byte per pass; passes where every key has the same byte are skipped
+    void sort() {
+        PROFILE_ZONE("RenderQueue::sort");
+        if (entries.empty()) {
+            return;
+        }
+        scratch.resize(entries.size());
+
+        for (int shift = 0; shift < 64; shift += 8) {
+            size_t counts[256] = {};
+            for (const auto& entry : entries) {
+                counts[(entry.key >> shift) & 0xFF]++;
+            }
+            if (counts[(entries[0].key >> shift) & 0xFF] == entries.size()) {
+                continue;
+            }
+
+            size_t offset = 0;
+            for (int bucket = 0; bucket < 256; bucket++) {
+                size_t count = counts[bucket];
+                counts[bucket] = offset;
+                offset += count;
+            }
+            for (const auto& entry : entries) {
+                scratch[counts[(entry.key >> shift) & 0xFF]++] = entry;
+            }
+            entries.swap(scratch);
+        }
+    }
+
+    // Issue every queued draw in key order (stamping each change of GPU pass when a timer is given)
+    void execute(GpuPassTimer* timer = nullptr) {
+        PROFILE_ZONE("RenderQueue::execute");
+        drawCount = programChanges = textureChanges = vaoChanges = 0;
+
+        int currentLayer = -1;
+        ShaderProgram* currentProgram = nullptr;
+        GLuint currentVAO = 0;
+        GLuint currentArray = 0, currentCube = 0;
+        GLuint currentDrawBuffer = 0;
+        GLintptr currentDrawOffset = -1;
+        glBindVertexArray(0);
 
-    // Calculate fog factor (linear fade)
-    float fogFactor = clamp((fogEnd - fogDistance) / (fogEnd - fogStart), 0.0, 1.0);
-    fogFactor = pow(fogFactor, 2.0); // Exponential curve for denser fog
+        for (const auto& entry : entries) {
+            const DrawCommand& cmd = commands[entry.index];
+            if (timer) {
+                timer->mark(cmd.gpuPass);
+            }
 
-    // Blend the fog color with the skybox color
-    vec4 color = mix(fogColor, skyboxColor, fogFactor);
+            int layer = (int)(entry.key >> 62);
+            if (layer != currentLayer) {
+                applyLayerState(layer);
+                currentLayer = layer;
+            }
+            if (cmd.program != currentProgram) {
+                cmd.program->use();
+                currentProgram = cmd.program;
+                programChanges++;
+            }
+            GLuint& boundTexture = cmd.textureTarget == GL_TEXTURE_CUBE_MAP ? currentCube : currentArray;
+            if (cmd.texture != boundTexture) {
+                glBindTexture(cmd.textureTarget, cmd.texture);
+                boundTexture = cmd.texture;
+                textureChanges++;
+            }
+            if (cmd.vao != currentVAO) {
+                glBindVertexArray(cmd.vao);
+                currentVAO = cmd.vao;
+                vaoChanges++;
+            }
+            if (cmd.drawDataBuffer && (cmd.drawDataBuffer != currentDrawBuffer || cmd.drawDataOffset != currentDrawOffset)) {
+                glBindBufferRange(GL_UNIFORM_BUFFER, OBJECT_DATA_BINDING, cmd.drawDataBuffer, cmd.drawDataOffset, sizeof(DrawRecord));
+                currentDrawBuffer = cmd.drawDataBuffer;
+                currentDrawOffset = cmd.drawDataOffset;
+            }
 
-    FragColor = color;
-}
-)";
+            if (cmd.batch) {
+                cmd.batch->drawPass(cmd.first);
+            }
+            else if (cmd.instanceCount > 0) {
+                if (cmd.instanceBuffer) {
+                    glBindBuffer(GL_ARRAY_BUFFER, cmd.instanceBuffer);
+                    glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*)cmd.instanceOffset);
+                }
+                glDrawArraysInstanced(cmd.mode, cmd.first, cmd.count, cmd.instanceCount);
+            }
+            else {
+                glDrawArrays(cmd.mode, cmd.first, cmd.count);
+            }
+            drawCount++;
+        }
 
+        // Leave GL in the default state the rest of the frame expects
+        applyLayerState(LAYER_OPAQUE);
+        glBindVertexArray(0);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    }
 
-#pragma endregion
-#pragma region Create Shader Program
-// Compile and link shaders
-GLuint createShaderProgram(const char* vertexSource, const char* fragmentSource) {
-    GLuint vertexShader = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(vertexShader, 1, &vertexSource, nullptr);
-    glCompileShader(vertexShader);
+private:
+    struct SortEntry {
+        uint64_t key;
+        uint32_t index;
+    };
 
-    GLuint fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(fragmentShader, 1, &fragmentSource, nullptr);
-    glCompileShader(fragmentShader);
+    std::vector<DrawCommand> commands;
+    std::vector<SortEntry> entries;
+    std::vector<SortEntry> scratch;
+    std::vector<GLuint> programIds, textureIds, vaoIds; // GL name -> position gives the dense id
+    glm::vec3 eyePos = glm::vec3(0.0f);
+
+    // Bit pattern of a non-negative float; ordering the bits as integers orders the floats
+    static uint32_t floatBits(float value) {
+        uint32_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        return bits;
+    }
 
-    GLuint shaderProgram = glCreateProgram();
-    glAttachShader(shaderProgram, vertexShader);
-    glAttachShader(shaderProgram, fragmentShader);
-    glLinkProgram(shaderProgram);
+    static uint32_t denseId(std::vector<GLuint>& table, GLuint name) {
+        for (size_t i = 0; i < table.size(); i++) {
+            if (table[i] == name) {
+                return (uint32_t)i;
+            }
+        }
+        table.push_back(name);
+        return (uint32_t)table.size() - 1;
+    }
 
-    glDeleteShader(vertexShader);
-    glDeleteShader(fragmentShader);
+    static void applyLayerState(int layer) {
+        if (layer == LAYER_OPAQUE) {
+            glDepthMask(GL_TRUE);
+            glDepthFunc(GL_LESS);
+            glDisable(GL_BLEND);
+        }
+        else if (layer == LAYER_SKYBOX) {
+            glDepthMask(GL_FALSE);
+            glDepthFunc(GL_LEQUAL);  // Skybox sits at maximum depth, so it only fills pixels left at the clear value
+            glDisable(GL_BLEND);
+        }
+        else {
+            glDepthMask(GL_TRUE);
+            glDepthFunc(GL_LESS);
+            glEnable(GL_BLEND);
+            glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        }
+    }
+};
 
-    return shaderProgram;
+// Queue one command per material pass of the static batch that still has a visible draw
+void submitStaticBatch(RenderQueue& queue, const StaticBatch& batch, ShaderProgram& program) {
+    if (!batch.isReady()) {
+        return;
+    }
+    const std::vector<StaticBatch::Pass>& passes = batch.getPasses();
+    for (size_t i = 0; i < passes.size(); i++) {
+        AABB bounds = batch.visibleBounds((int)i);
+        if (bounds.isEmpty()) {
+            continue;
+        }
+        DrawCommand cmd;
+        cmd.program = &program;
+        cmd.vao = batch.getVAO();
+        cmd.texture = passes[i].texture;
+        cmd.batch = &batch;
+        cmd.first = (GLint)i;
+        cmd.gpuPass = passes[i].gpuPass;
+        queue.submit(LAYER_OPAQUE, cmd, bounds);
+    }
 }
 #pragma endregion
 #pragma region Vertices
@@ -530,6 +4837,87 @@ float skyboxVertices[] = {
      1.0f, -1.0f,  1.0f
 };
 #pragma endregion
+#pragma region Wheat Field Instancing
+// Default wheat field layout: a 201 x 41 grid of stalks, 0.25 units apart, pushed back along Z by wheatOffset.
+// Offsets are stored x-major so the instanced draw covers the stalks in the same order as the old nested loop.
+std::vector<glm::vec3> buildWheatGridOffsets(float wheatOffset) {
+    std::vector<glm::vec3> offsets;
+    offsets.reserve(201 * 41);
+
+    for (int x = -100; x <= 100; ++x) {
+        for (int z = -20; z <= 20; ++z) {
+            offsets.push_back(glm::vec3(x * 0.25f, 0.0f, wheatOffset + z * 0.25f));
+        }
+    }
+    return offsets;
+}
+
+// Upload per-instance offsets into their own buffer and hook them to attribute 2 of the given VAO
+GLuint createInstanceBuffer(GLuint vao, const std::vector<glm::vec3>& offsets) {
+    GLuint instanceVBO;
+    glGenBuffers(1, &instanceVBO);
+
+    glBindVertexArray(vao);
+    glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+    glBufferData(GL_ARRAY_BUFFER, offsets.size() * sizeof(glm::vec3), offsets.data(), GL_STATIC_DRAW);
+    glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*)0);
+    glEnableVertexAttribArray(2);
+    glVertexAttribDivisor(2, 1); // Advance once per instance, not per vertex
+    glBindVertexArray(0);
+
+    return instanceVBO;
+}
+
+// A contiguous range of instances culled as one unit
+struct InstanceChunk {
+    GLint first;
+    GLsizei count;
+    AABB bounds; // World-space bounds (instances are drawn with an identity model matrix)
+};
+
+// Split the instance list into runs of chunkSize instances; for the wheat grid a chunk is a strip of whole columns
+std::vector<InstanceChunk> buildInstanceChunks(const std::vector<glm::vec3>& offsets, const AABB& meshBounds, int chunkSize) {
+    std::vector<InstanceChunk> chunks;
+    for (size_t first = 0; first < offsets.size(); first += chunkSize) {
+        InstanceChunk chunk;
+        chunk.first = (GLint)first;
+        chunk.count = (GLsizei)std::min(offsets.size() - first, (size_t)chunkSize);
+        for (GLsizei i = 0; i < chunk.count; i++) {
+            chunk.bounds.expand(meshBounds.min + offsets[first + i]);
+            chunk.bounds.expand(meshBounds.max + offsets[first + i]);
+        }
+        chunks.push_back(chunk);
+    }
+    return chunks;
+}
+
+// Queue the visible chunks, merging neighbouring visible chunks into one instanced draw.
+// The instance attribute is re-pointed at the first instance of each run (no base-instance support needed).
+void submitInstanceChunks(RenderQueue& queue, const DrawCommand& base, const std::vector<InstanceChunk>& chunks, Culler& culler) {
+    // Each chunk is tested once; a run is submitted when an invisible chunk (or the end) closes it
+    GLint first = 0;
+    GLsizei count = 0;
+    AABB runBounds;
+    for (size_t i = 0; i <= chunks.size(); i++) {
+        if (i < chunks.size() && culler.isVisible(chunks[i].bounds)) {
+            if (count == 0) {
+                first = chunks[i].first;
+                runBounds = AABB();
+            }
+            count += chunks[i].count;
+            runBounds.expand(chunks[i].bounds);
+            continue;
+        }
+        if (count > 0) {
+            DrawCommand cmd = base;
+            cmd.instanceCount = count;
+            cmd.instanceOffset = (GLintptr)(first * sizeof(glm::vec3));
+            queue.submit(LAYER_OPAQUE, cmd, runBounds);
+            count = 0;
+        }
+    }
+}
+#pragma endregion
 #pragma region FRAMBUFFER and Render tree function
 // GLFW framebuffer size callback
 void framebuffer_size_callback(GLFWwindow* window, int width, int height) {
@@ -537,33 +4925,587 @@ void framebuffer_size_callback(GLFWwindow* window, int width, int height) {
     glViewport(0, 0, width, height);
 }
 
-void renderTree(GLuint treeVAO, GLuint treeTexture, GLint modelLoc, glm::vec3 translation) {
-    // Create the tree model matrix
-    glm::mat4 treeModel = glm::mat4(1.0f);
-    treeModel = glm::translate(treeModel, translation); // Apply translation
-    treeModel = glm::scale(treeModel, glm::vec3(4.0f, 4.0f, 4.0f)); // Apply scaling
-    treeModel = glm::scale(treeModel, glm::vec3(1.0f, -1.0f, 1.0f)); // Flip along y-axis (if needed)
+void renderTree(RenderQueue& queue, GLuint treeVAO, const Material& treeMaterial, ShaderProgram& program, UniformRingBuffer& ring, Culler& culler, const SceneGraph& scene, int treeNode) {
+    if (!culler.isVisible(scene.worldBounds(treeNode))) {
+        return;
+    }
+
+    // Queue the tree quad with its cached model matrix (blended, so it is sorted back-to-front with the transparent layer)
+    DrawCommand cmd;
+    cmd.program = &program;
+    cmd.drawDataOffset = ring.writeDraw(scene.world(treeNode), treeMaterial.layer);
+    if (cmd.drawDataOffset < 0) {
+        return;
+    }
+    cmd.drawDataBuffer = ring.id();
+    cmd.vao = treeVAO;
+    cmd.texture = treeMaterial.arrayTexture;
+    cmd.mode = GL_TRIANGLE_STRIP;
+    cmd.count = 4;
+    cmd.gpuPass = GPU_PASS_TREES;
+    queue.submit(LAYER_TRANSPARENT, cmd, scene.worldBounds(treeNode));
+}
+#pragma endregion
+#pragma region Startup Tracing
+// Wall-clock breakdown of startup on the main thread: each phase() call ends the running phase and starts the
+// next, and finish() (after the first glfwSwapBuffers) closes the last one. Times are from the start of main.
+class StartupTracer {
+public:
+    struct Phase {
+        std::string name;
+        double ms;
+    };
+
+    std::vector<Phase> phases;
+    double totalMs = 0.0;
 
-    // Set the model matrix uniform
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(treeModel));
+    StartupTracer() : origin(std::chrono::steady_clock::now()), phaseStart(origin) {}
 
-    // Bind the tree VAO and texture, then draw the tree
-    glBindVertexArray(treeVAO);
-    glBindTexture(GL_TEXTURE_2D, treeTexture);
-    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    void phase(const char* name) {
+        closePhase();
+        current = name;
+    }
+
+    void finish() {
+        closePhase();
+        current.clear();
+        totalMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - origin).count();
+    }
+
+    void print() const {
+        std::cout << "Startup: " << totalMs << " ms to the first frame" << std::endl;
+        for (const Phase& phase : phases) {
+            std::cout << "  " << phase.name << ": " << phase.ms << " ms" << std::endl;
+        }
+    }
+
+    // One phase per line, so readStartupReport can read the file back without a JSON parser
+    bool writeReport(const std::string& path) const {
+        std::ofstream out(path, std::ios::trunc);
+        if (!out) {
+            std::cerr << "Startup: could not write " << path << std::endl;
+            return false;
+        }
+        out << "{\n  \"total_ms\": " << totalMs << ",\n  \"phases\": [\n";
+        for (size_t i = 0; i < phases.size(); i++) {
+            out << "    { \"name\": \"" << phases[i].name << "\", \"ms\": " << phases[i].ms << " }" << (i + 1 < phases.size() ? ",\n" : "\n");
+        }
+        out << "  ]\n}\n";
+        return true;
+    }
+
+private:
+    std::chrono::steady_clock::time_point origin;
+    std::chrono::steady_clock::time_point phaseStart;
+    std::string current;
+
+    void closePhase() {
+        auto now = std::chrono::steady_clock::now();
+        if (!current.empty()) {
+            phases.push_back({ current, std::chrono::duration<double, std::milli>(now - phaseStart).count() });
+        }
+        phaseStart = now;
+    }
+};
+
+// Read back a report written by StartupTracer::writeReport
+bool readStartupReport(const std::string& path, StartupTracer& report) {
+    std::ifstream in(path);
+    if (!in) {
+        return false;
+    }
+    report.phases.clear();
+    report.totalMs = 0.0;
+    std::string line;
+    while (std::getline(in, line)) {
+        char name[128];
+        double ms;
+        if (std::sscanf(line.c_str(), " { \"name\": \"%127[^\"]\", \"ms\": %lf", name, &ms) == 2) {
+            report.phases.push_back({ name, ms });
+        }
+        else {
+            std::sscanf(line.c_str(), " \"total_ms\": %lf", &report.totalMs);
+        }
+    }
+    return !report.phases.empty();
+}
+
+#ifndef _WIN32
+// Ask the kernel to drop the cached pages of every file below path (only clean, unmapped pages go)
+bool evictFileCache(const std::string& path) {
+    struct stat info;
+    if (stat(path.c_str(), &info) != 0) {
+        return false;
+    }
+    if (S_ISDIR(info.st_mode)) {
+        DIR* dir = opendir(path.c_str());
+        if (!dir) {
+            return false;
+        }
+        bool evicted = false;
+        while (dirent* entry = readdir(dir)) {
+            if (std::strcmp(entry->d_name, ".") != 0 && std::strcmp(entry->d_name, "..") != 0) {
+                evicted |= evictFileCache(path + "/" + entry->d_name);
+            }
+        }
+        closedir(dir);
+        return evicted;
+    }
+#ifdef POSIX_FADV_DONTNEED
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    bool evicted = posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) == 0;
+    close(fd);
+    return evicted;
+#else
+    return false;
+#endif
+}
+#endif
+
+// Make the next start cold: drop the whole page cache when permitted (root on Linux), otherwise evict the
+// given files and directories one by one. Returns false where neither is possible (Windows, macOS).
+bool dropFileCache(const std::vector<std::string>& paths) {
+#ifdef _WIN32
+    return false;
+#else
+    sync();
+    {
+        std::ofstream dropCaches("/proc/sys/vm/drop_caches");
+        if (dropCaches && (dropCaches << "3").flush()) {
+            return true;
+        }
+    }
+    bool evicted = false;
+    for (const std::string& path : paths) {
+        evicted |= evictFileCache(path);
+    }
+    return evicted;
+#endif
+}
+
+// Run a command line through the shell and return its exit code
+int runCommand(const std::string& command) {
+#ifdef _WIN32
+    return std::system(("\"" + command + "\"").c_str()); // cmd /c strips one pair of outer quotes
+#else
+    return std::system(command.c_str());
+#endif
+}
+
+// --benchmark-startup: start the program runs times cold and runs times warm (one untimed start primes the
+// cache first), each child exiting after its first frame and writing its phase breakdown, then report the mean
+// process time, time to first frame and per-phase times of each set
+int benchmarkStartup(const std::string& executable, const std::vector<std::string>& forwardedArgs, int runs,
+    const std::vector<std::string>& cachedPaths, const std::string& reportPath) {
+    const std::string childReport = "startup_run.json";
+    std::string command = "\"" + executable + "\"";
+    for (const std::string& arg : forwardedArgs) {
+        command += " \"" + arg + "\"";
+    }
+    command += " --exit-after-first-frame --startup-report=" + childReport;
+
+    struct RunSet {
+        const char* name;
+        bool cold;
+        int completed = 0;
+        double processMs = 0.0, minProcessMs = 0.0, maxProcessMs = 0.0;
+        double firstFrameMs = 0.0;
+        std::vector<StartupTracer::Phase> phases; // Summed over the runs
+    };
+    RunSet sets[2];
+    sets[0].name = "cold";
+    sets[0].cold = true;
+    sets[1].name = "warm";
+    sets[1].cold = false;
+
+    for (RunSet& set : sets) {
+        if (!set.cold) {
+            runCommand(command); // Prime the cache
+        }
+        for (int run = 0; run < runs; run++) {
+            if (set.cold && !dropFileCache(cachedPaths)) {
+                std::cout << "Startup benchmark: the file cache cannot be dropped here, skipping cold starts" << std::endl;
+                break;
+            }
+            std::remove(childReport.c_str());
+            auto start = std::chrono::steady_clock::now();
+            int status = runCommand(command);
+            double processMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            StartupTracer report;
+            if (status != 0 || !readStartupReport(childReport, report)) {
+                std::cerr << "Startup benchmark: run " << run + 1 << " (" << set.name << ") failed" << std::endl;
+                continue;
+            }
+            set.processMs += processMs;
+            set.minProcessMs = set.completed == 0 ? processMs : std::min(set.minProcessMs, processMs);
+            set.maxProcessMs = std::max(set.maxProcessMs, processMs);
+            set.firstFrameMs += report.totalMs;
+            for (const StartupTracer::Phase& phase : report.phases) {
+                auto it = std::find_if(set.phases.begin(), set.phases.end(), [&phase](const StartupTracer::Phase& p) { return p.name == phase.name; });
+                if (it == set.phases.end()) set.phases.push_back(phase);
+                else it->ms += phase.ms;
+            }
+            set.completed++;
+        }
+        std::remove(childReport.c_str());
+    }
+
+    std::ofstream out(reportPath, std::ios::trunc);
+    out << "{\n";
+    for (int s = 0; s < 2; s++) {
+        const RunSet& set = sets[s];
+        double n = set.completed > 0 ? set.completed : 1.0;
+        std::cout << "Startup benchmark (" << set.name << ", " << set.completed << " runs): process " << set.processMs / n << " ms (min "
+            << set.minProcessMs << ", max " << set.maxProcessMs << "), first frame " << set.firstFrameMs / n << " ms" << std::endl;
+        out << "  \"" << set.name << "\": {\n    \"runs\": " << set.completed << ",\n    \"process_ms\": { \"mean\": " << set.processMs / n
+            << ", \"min\": " << set.minProcessMs << ", \"max\": " << set.maxProcessMs << " },\n    \"first_frame_ms\": " << set.firstFrameMs / n
+            << ",\n    \"phases_ms\": {";
+        for (size_t i = 0; i < set.phases.size(); i++) {
+            std::cout << "  " << set.phases[i].name << ": " << set.phases[i].ms / n << " ms" << std::endl;
+            out << (i > 0 ? ", " : " ") << "\"" << set.phases[i].name << "\": " << set.phases[i].ms / n;
+        }
+        out << " }\n  }" << (s == 0 ? ",\n" : "\n");
+    }
+    out << "}\n";
+    std::cout << "Startup benchmark: report written to " << reportPath << std::endl;
+    return sets[0].completed + sets[1].completed > 0 ? 0 : -1;
+}
+#pragma endregion
+#pragma region Benchmark Mode
+// CPU phases of one frame, timed by FrameBenchmark::mark at the end of each phase
+enum BenchmarkPhase {
+    PHASE_INPUT,        // Camera update (scripted path in benchmark mode)
+    PHASE_STREAMING,    // Async hand-off and the streamer's upload budget
+    PHASE_CULLING,      // Scene transforms, static batch update and the frustum
+    PHASE_QUEUE,        // Culling and queueing this frame's draw commands
+    PHASE_SUBMIT,       // Sorting and issuing the GL calls
+    PHASE_PRESENT,      // Swap (window) or glFinish (headless)
+    PHASE_COUNT
+};
+
+const char* benchmarkPhaseName(int phase) {
+    static const char* names[PHASE_COUNT] = { "input", "streaming", "culling", "queue", "submit", "present" };
+    return names[phase];
+}
+
+// Scripted camera for benchmark runs: walks the road to its far end and back while weaving
+// between the kerbs and sweeping the yaw, so every run renders the same sequence of views
+void benchmarkCamera(int frame, int frameCount) {
+    const float twoPi = 6.28318531f;
+    float t = frameCount > 1 ? (float)frame / (float)(frameCount - 1) : 0.0f;
+    float walk = 0.5f - 0.5f * std::cos(t * twoPi);
+    cameraPos = glm::vec3(glm::mix(minBoundary.x, maxBoundary.x, walk), minBoundary.y, maxBoundary.z * std::sin(t * 2.0f * twoPi));
+    cameraYaw = 45.0f * std::sin(t * 3.0f * twoPi);
+    updateCameraFront();
+    view = glm::lookAt(cameraPos, cameraPos + cameraFront, cameraUp);
 }
+
+// Frame and per-phase CPU times for --benchmark. Frames are recorded once every asset is resident
+// and a few warm-up frames have passed; nothing is timed when the benchmark is off.
+struct FrameBenchmark {
+    int frameCount = 0;          // Frames to record, 0 when the benchmark is off
+    int warmupFrames = 30;
+    int recordedFrames = 0;
+    int warmupLeft = 0;
+    bool recording = false;
+    std::vector<double> frameMs;
+    std::vector<double> phaseMs[PHASE_COUNT];
+    std::chrono::steady_clock::time_point frameStart;
+    std::chrono::steady_clock::time_point phaseStart;
+
+    bool enabled() const { return frameCount > 0; }
+    bool finished() const { return enabled() && recordedFrames >= frameCount; }
+
+    void start(int frames) {
+        frameCount = frames;
+        warmupLeft = warmupFrames;
+        frameMs.reserve(frames);
+        for (auto& phase : phaseMs) phase.reserve(frames);
+    }
+
+    // Called at the top of a frame; ready tells whether loading has finished
+    void beginFrame(bool ready) {
+        if (!enabled() || finished()) {
+            recording = false;
+            return;
+        }
+        if (ready && warmupLeft > 0) {
+            warmupLeft--;
+        }
+        recording = ready && warmupLeft == 0;
+        frameStart = std::chrono::steady_clock::now();
+        phaseStart = frameStart;
+    }
+
+    void mark(BenchmarkPhase phase) {
+        if (!recording) return;
+        auto now = std::chrono::steady_clock::now();
+        phaseMs[phase].push_back(std::chrono::duration<double, std::milli>(now - phaseStart).count());
+        phaseStart = now;
+    }
+
+    void endFrame() {
+        if (!recording) return;
+        frameMs.push_back(std::chrono::duration<double, std::milli>(phaseStart - frameStart).count());
+        recordedFrames++;
+    }
+
+    // Nearest-rank percentile of an unsorted sample
+    static double percentile(std::vector<double> samples, double p) {
+        if (samples.empty()) return 0.0;
+        std::sort(samples.begin(), samples.end());
+        size_t rank = (size_t)std::ceil(p / 100.0 * samples.size());
+        return samples[rank > 0 ? rank - 1 : 0];
+    }
+
+    static void writeStats(std::ostream& out, const std::vector<double>& samples) {
+        double sum = 0.0;
+        for (double sample : samples) sum += sample;
+        out << "{ \"mean\": " << (samples.empty() ? 0.0 : sum / samples.size())
+            << ", \"p50\": " << percentile(samples, 50.0)
+            << ", \"p95\": " << percentile(samples, 95.0)
+            << ", \"p99\": " << percentile(samples, 99.0)
+            << ", \"max\": " << percentile(samples, 100.0) << " }";
+    }
+
+    bool writeReport(const std::string& path, int width, int height, const std::string& context, const std::string& renderer,
+        const GpuPassTimer& gpuTimer) const {
+        std::ofstream out(path, std::ios::trunc);
+        if (!out) {
+            std::cerr << "Benchmark: could not write " << path << std::endl;
+            return false;
+        }
+        std::string escapedRenderer;
+        for (char c : renderer) {
+            if (c == '"' || c == '\\') escapedRenderer += '\\';
+            escapedRenderer += c;
+        }
+        out << "{\n";
+        out << "  \"frames\": " << recordedFrames << ",\n";
+        out << "  \"width\": " << width << ",\n";
+        out << "  \"height\": " << height << ",\n";
+        out << "  \"context\": \"" << context << "\",\n";
+        out << "  \"renderer\": \"" << escapedRenderer << "\",\n";
+        out << "  \"frame_ms\": ";
+        writeStats(out, frameMs);
+        out << ",\n  \"cpu_phase_ms\": {\n";
+        for (int phase = 0; phase < PHASE_COUNT; phase++) {
+            out << "    \"" << benchmarkPhaseName(phase) << "\": ";
+            writeStats(out, phaseMs[phase]);
+            out << (phase + 1 < PHASE_COUNT ? ",\n" : "\n");
+        }
+        out << "  }";
+        if (gpuTimer.isEnabled()) {
+            // Rolling averages over the last frames of the run
+            out << ",\n  \"gpu_pass_ms\": {";
+            for (int pass = 0; pass < GPU_PASS_COUNT; pass++) {
+                out << (pass > 0 ? ", " : " ") << "\"" << gpuPassName(pass) << "\": " << gpuTimer.average(pass);
+            }
+            out << " }";
+        }
+        out << "\n}\n";
+        return true;
+    }
+};
 #pragma endregion
 #pragma region Main Render Function
-int main() {
-    // GLFW initialization
+int main(int argc, char** argv) {
+    StartupTracer startup;
+    startup.phase("arguments");
+
+    // --async: start rendering immediately and stream the assets in behind placeholders
+    // --vertex-format=float|packed|packed-normals: GPU layout of the static models' vertices
+    // --keep-cpu-data: keep the models' vertex and index arrays in memory after upload
+    // --texture-compression=off|bc|bc7: storage of the textures (bc: BC1 opaque, BC3 with alpha)
+    // --encode-textures: write the KTX2 file of every scene texture and exit without opening a window (a normal
+    //   start only reads KTX2 files that are up to date and uploads the other images uncompressed)
+    // --model-loader=obj|assimp: importer for .obj models missing from the mesh cache
+    // --benchmark-model-loaders: time both importers on the scene models and exit without opening a window
+    // --benchmark[=N]: render N frames (default 1000) along a scripted camera path, write a JSON report and exit
+    // --benchmark-report=PATH: where the benchmark report goes (default benchmark.json)
+    // --headless: render offscreen (EGL surfaceless, or OSMesa) instead of opening a window; needs --benchmark
+    //     or --exit-after-first-frame, since nothing else ends the render loop
+    // --resolution=WxH: window or offscreen framebuffer size (default 800x600)
+    // --trace[=PATH]: record CPU profiling zones and write them as a Chrome trace on exit (default trace.json)
+    // --startup-report=PATH: write the startup phase breakdown (up to the first frame) as JSON
+    // --exit-after-first-frame: quit once the first frame has been presented
+    // --benchmark-startup[=N]: start the program N times (default 5) cold and N times warm with the other
+    //   arguments, write the mean startup breakdowns to --startup-report (default startup_benchmark.json) and exit
+    bool asyncLoading = false;
+    bool keepCpuData = false;
+    bool benchmarkModelLoaders = false;
+    bool headless = false;
+    int benchmarkFrames = 0;
+    std::string benchmarkReportPath = "benchmark.json";
+    std::string tracePath;
+    std::string startupReportPath;
+    bool exitAfterFirstFrame = false;
+    int startupRuns = 0;
+    int width = 800;
+    int height = 600;
+    VertexFormat vertexFormat = VERTEX_FORMAT_PACKED;
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--async") == 0) asyncLoading = true;
+        else if (std::strcmp(argv[i], "--keep-cpu-data") == 0) keepCpuData = true;
+        else if (std::strcmp(argv[i], "--encode-textures") == 0) encodeTextures = true;
+        else if (std::strcmp(argv[i], "--model-loader=obj") == 0) modelLoader = MODEL_LOADER_OBJ;
+        else if (std::strcmp(argv[i], "--model-loader=assimp") == 0) modelLoader = MODEL_LOADER_ASSIMP;
+        else if (std::strcmp(argv[i], "--benchmark-model-loaders") == 0) benchmarkModelLoaders = true;
+        else if (std::strcmp(argv[i], "--benchmark") == 0) benchmarkFrames = 1000;
+        else if (std::strncmp(argv[i], "--benchmark=", 12) == 0) benchmarkFrames = std::max(1, std::atoi(argv[i] + 12));
+        else if (std::strncmp(argv[i], "--benchmark-report=", 19) == 0) benchmarkReportPath = argv[i] + 19;
+        else if (std::strcmp(argv[i], "--headless") == 0) headless = true;
+        else if (std::strcmp(argv[i], "--trace") == 0) tracePath = "trace.json";
+        else if (std::strncmp(argv[i], "--trace=", 8) == 0) tracePath = argv[i] + 8;
+        else if (std::strncmp(argv[i], "--startup-report=", 17) == 0) startupReportPath = argv[i] + 17;
+        else if (std::strcmp(argv[i], "--exit-after-first-frame") == 0) exitAfterFirstFrame = true;
+        else if (std::strcmp(argv[i], "--benchmark-startup") == 0) startupRuns = 5;
+        else if (std::strncmp(argv[i], "--benchmark-startup=", 20) == 0) startupRuns = std::max(1, std::atoi(argv[i] + 20));
+        else if (std::strncmp(argv[i], "--resolution=", 13) == 0) {
+            int w = 0, h = 0;
+            if (std::sscanf(argv[i] + 13, "%dx%d", &w, &h) == 2 && w > 0 && h > 0) {
+                width = w;
+                height = h;
+            }
+        }
+        else if (std::strcmp(argv[i], "--texture-compression=off") == 0) textureCompression = COMPRESSION_OFF;
+        else if (std::strcmp(argv[i], "--texture-compression=bc") == 0) textureCompression = COMPRESSION_BC;
+        else if (std::strcmp(argv[i], "--texture-compression=bc7") == 0) textureCompression = COMPRESSION_BC7;
+        else if (std::strcmp(argv[i], "--vertex-format=float") == 0) vertexFormat = VERTEX_FORMAT_FLOAT;
+        else if (std::strcmp(argv[i], "--vertex-format=packed") == 0) vertexFormat = VERTEX_FORMAT_PACKED;
+        else if (std::strcmp(argv[i], "--vertex-format=packed-normals") == 0) vertexFormat = VERTEX_FORMAT_PACKED_NORMALS;
+    }
+    startTrace(tracePath);
+
+    // Scene assets
+    const char* roadTexturePath = "../assets/textures/road.jpg";
+    const char* grassTexturePath = "../assets/textures/grass-texture.jpg";
+    const char* wheatTexturePath = "../assets/textures/wheat-texture.png";
+    const char* treeTexturePath = "../assets/textures/tree-texture.png";
+    const char* houseModelPath = R"(../assets/house/medieval house.obj)";
+    const char* castleModelPath = R"(../assets/castle/Palace.obj)";
+    std::vector<std::string> faces = {
+        R"(..\assets\skybox\nx.png)",
+        R"(..\assets\skybox\px.png)",
+        R"(..\assets\skybox\ny.png)",
+        R"(..\assets\skybox\py.png)",
+        R"(..\assets\skybox\nz.png)",
+        R"(..\assets\skybox\pz.png)"
+    };
+
+    if (encodeTextures) {
+        // Loading the models registers their textures; every load encodes and writes any missing or stale KTX2 file
+        if (textureCompression == COMPRESSION_OFF) textureCompression = COMPRESSION_BC;
+        unsigned int hardwareThreads = std::thread::hardware_concurrency();
+        workerPool.start(hardwareThreads > 1 ? hardwareThreads - 1 : 1);
+        for (const char* path : { roadTexturePath, grassTexturePath, wheatTexturePath }) {
+            loadTexture(path);
+        }
+        loadTreeTexture(treeTexturePath);
+        std::vector<Mesh> models;
+        loadModel(houseModelPath, models);
+        loadModel(castleModelPath, models);
+        CubemapImages skyboxImages;
+        decodeCubemap(faces, skyboxImages);
+        workerPool.stop();
+        finishTrace(tracePath);
+        std::cout << "Texture compression: scene textures written as " << (textureCompression == COMPRESSION_BC7 ? "BC7" : "BC1/BC3") << " KTX2 files" << std::endl;
+        return 0;
+    }
+
+    if (benchmarkModelLoaders) {
+        // Both importers bypass the mesh cache; the first run of each warms the file cache and registers the textures
+        const int runs = 5;
+        unsigned int hardwareThreads = std::thread::hardware_concurrency();
+        workerPool.start(hardwareThreads > 1 ? hardwareThreads - 1 : 1);
+        for (const char* path : { houseModelPath, castleModelPath }) {
+            double milliseconds[2] = { 0.0, 0.0 };
+            size_t vertexCount[2] = { 0, 0 };
+            size_t triangleCount[2] = { 0, 0 };
+            for (int loader = 0; loader < 2; loader++) {
+                for (int run = 0; run <= runs; run++) {
+                    std::vector<Mesh> models;
+                    auto start = std::chrono::steady_clock::now();
+                    bool loaded = loader == 0 ? loadObj(path, models) : importWithAssimp(path, models);
+                    auto end = std::chrono::steady_clock::now();
+                    if (!loaded) break;
+                    releaseMaterials(models);
+                    if (run == 0) {
+                        for (const Mesh& mesh : models) {
+                            vertexCount[loader] += mesh.getVertices().size();
+                            triangleCount[loader] += mesh.getIndices().size() / 3;
+                        }
+                        continue;
+                    }
+                    milliseconds[loader] += std::chrono::duration<double, std::milli>(end - start).count() / runs;
+                }
+            }
+            std::cout << "Model loaders: " << path << std::endl;
+            std::cout << "  obj:    " << milliseconds[0] << " ms, " << vertexCount[0] << " vertices, " << triangleCount[0] << " triangles" << std::endl;
+            std::cout << "  assimp: " << milliseconds[1] << " ms, " << vertexCount[1] << " vertices, " << triangleCount[1] << " triangles" << std::endl;
+            if (milliseconds[0] > 0.0) {
+                std::cout << "  speedup: " << milliseconds[1] / milliseconds[0] << "x" << std::endl;
+            }
+        }
+        workerPool.stop();
+        finishTrace(tracePath);
+        return 0;
+    }
+
+    if (startupRuns > 0) {
+        // Children get every other argument; cold runs evict the assets and the executable from the file cache
+        std::vector<std::string> forwardedArgs;
+        for (int i = 1; i < argc; i++) {
+            if (std::strncmp(argv[i], "--benchmark-startup", 19) != 0 && std::strncmp(argv[i], "--startup-report=", 17) != 0 &&
+                std::strcmp(argv[i], "--exit-after-first-frame") != 0) {
+                forwardedArgs.push_back(argv[i]);
+            }
+        }
+        return benchmarkStartup(argv[0], forwardedArgs, startupRuns, { "../assets", argv[0] },
+            startupReportPath.empty() ? "startup_benchmark.json" : startupReportPath);
+    }
+
+    // Nothing can close an offscreen context, so a headless render has to end on its own
+    if (headless && benchmarkFrames == 0 && !exitAfterFirstFrame) {
+        std::cerr << "Usage: --headless needs --benchmark[=N] or --exit-after-first-frame" << std::endl;
+        return 1;
+    }
+
+    // GLFW initialization (headless runs use the null platform, so no display server is needed)
+#ifdef GLFW_PLATFORM_NULL
+    if (headless) {
+        glfwInitHint(GLFW_PLATFORM, GLFW_PLATFORM_NULL);
+    }
+#endif
+    startup.phase("glfwInit");
     if (!glfwInit()) {
         std::cerr << "GLFW initialization failed!" << std::endl;
         return -1;
     }
 
+    startup.phase("create window");
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
-    GLFWwindow* window = glfwCreateWindow(800, 600, "OpenGL Medieval Scene", nullptr, nullptr);
+    GLFWwindow* window = nullptr;
+    std::string contextName = "window";
+    if (headless) {
+        // The window only carries the context; frames go to an offscreen framebuffer. EGL first, OSMesa where EGL is missing.
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+        glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_EGL_CONTEXT_API);
+        window = glfwCreateWindow(width, height, "OpenGL Medieval Scene", nullptr, nullptr);
+        contextName = "egl";
+        if (!window) {
+            glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_OSMESA_CONTEXT_API);
+            window = glfwCreateWindow(width, height, "OpenGL Medieval Scene", nullptr, nullptr);
+            contextName = "osmesa";
+        }
+    }
+    else {
+        window = glfwCreateWindow(width, height, "OpenGL Medieval Scene", nullptr, nullptr);
+    }
 
     if (!window) {
         std::cerr << "Failed to create GLFW window!" << std::endl;
@@ -573,38 +5515,117 @@ int main() {
 
     glfwMakeContextCurrent(window);
     glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
+    startup.phase("glewInit");
     glewInit();
 
+    // Headless frames render into this framebuffer at the requested size
+    GLuint offscreenFBO = 0;
+    GLuint offscreenRenderbuffers[2] = { 0, 0 };
+    if (headless) {
+        glGenFramebuffers(1, &offscreenFBO);
+        glGenRenderbuffers(2, offscreenRenderbuffers);
+        glBindRenderbuffer(GL_RENDERBUFFER, offscreenRenderbuffers[0]);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+        glBindRenderbuffer(GL_RENDERBUFFER, offscreenRenderbuffers[1]);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+        glBindRenderbuffer(GL_RENDERBUFFER, 0);
+        glBindFramebuffer(GL_FRAMEBUFFER, offscreenFBO);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, offscreenRenderbuffers[0]);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, offscreenRenderbuffers[1]);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+            std::cerr << "Headless: offscreen framebuffer is incomplete" << std::endl;
+            glfwTerminate();
+            return -1;
+        }
+        glViewport(0, 0, width, height);
+    }
+    projection = glm::perspective(glm::radians(60.0f), (float)width / (float)height, 0.1f, 50.0f);
+
+    // Benchmark runs are not tied to the display refresh
+    FrameBenchmark benchmark;
+    if (benchmarkFrames > 0) {
+        benchmark.start(benchmarkFrames);
+        glfwSwapInterval(0);
+    }
+
+    // Block-compressed uploads need S3TC (and BPTC for BC7); otherwise fall back to what the driver has
+    if (textureCompression == COMPRESSION_BC7 && !(GLEW_VERSION_4_2 || GLEW_ARB_texture_compression_bptc)) {
+        textureCompression = COMPRESSION_BC;
+    }
+    if (textureCompression == COMPRESSION_BC && !GLEW_EXT_texture_compression_s3tc) {
+        textureCompression = COMPRESSION_OFF;
+    }
+
     // Shader program
-    GLuint shaderProgram = createShaderProgram(vertexShaderSource, fragmentShaderSource);
-    GLuint skyboxShaderProgram = createShaderProgram(skyboxVertexShaderSource, skyboxFragmentShaderSource);
+    startup.phase("shaders");
+    ShaderProgram shaderProgram(vertexShaderSource, fragmentShaderSource);
+    ShaderProgram staticShaderProgram(vertexShaderSource, fragmentShaderSource,
+        "#define STATIC_BATCH\n#define MAX_STATIC_DRAWS " + std::to_string(MAX_STATIC_DRAWS) + "\n");
+    ShaderProgram skyboxShaderProgram(skyboxVertexShaderSource, skyboxFragmentShaderSource);
+
+    // Camera and fog state is shared by every program through the FrameData block; per-draw model
+    // matrices and texture layers come from DrawRecords (ObjectData for single draws, DrawData for the batch)
+    shaderProgram.bindUniformBlock("FrameData", FRAME_DATA_BINDING);
+    shaderProgram.bindUniformBlock("ObjectData", OBJECT_DATA_BINDING);
+    skyboxShaderProgram.bindUniformBlock("FrameData", FRAME_DATA_BINDING);
+    staticShaderProgram.bindUniformBlock("FrameData", FRAME_DATA_BINDING);
+    staticShaderProgram.bindUniformBlock("DrawData", DRAW_DATA_BINDING);
+    startup.phase("uniform buffers");
+    UniformRingBuffer uniformRing;
+    uniformRing.create();
+    GpuPassTimer gpuTimer;
+    gpuTimer.create();
+    std::cout << "Uniform ring buffer: " << (uniformRing.isPersistent() ? "persistent mapping" : "per-frame mapping") << std::endl;
+
+    // Image decoding runs on worker threads while this thread loads models and sets up GL objects
+    startup.phase("worker pool");
+    unsigned int hardwareThreads = std::thread::hardware_concurrency();
+    workerPool.start(hardwareThreads > 1 ? hardwareThreads - 1 : 1);
+
+    // Streamed uploads are limited to 4 MB per frame
+    AssetStreamer streamer;
+    streamer.create(4 * 1024 * 1024);
+    textureLibrary.createPlaceholders();
 
     // Road and grass texture loading
-    GLuint roadTexture = loadTexture("../assets/textures/road.jpg");
-    GLuint grassTexture = loadTexture("../assets/textures/grass-texture.jpg");
+    startup.phase("register textures");
+    int roadTexture = loadTexture(roadTexturePath);
+    int grassTexture = loadTexture(grassTexturePath);
 
-    GLuint wheatTexture = loadTexture("../assets/textures/wheat-texture.png");
+    int wheatTexture = loadTexture(wheatTexturePath);
 
-    GLuint treeTexture = loadTreeTexture("../assets/textures/tree-texture.png");
+    int treeTexture = loadTreeTexture(treeTexturePath);
 
-    // House load
+    // House load (on worker threads in async mode; their textures are registered from there)
+    startup.phase("load models");
     std::vector<Mesh> meshes;
-    loadModel(R"(../assets/house/medieval house.obj)", meshes);
     std::vector<Mesh> castleMeshes;
-    loadModel(R"(../assets/castle/Palace.obj)", castleMeshes);
+    std::atomic<int> modelsPending(0);
+    if (asyncLoading) {
+        modelsPending = 2;
+        workerPool.submit([&meshes, &modelsPending, houseModelPath]() { loadModel(houseModelPath, meshes); modelsPending--; });
+        workerPool.submit([&castleMeshes, &modelsPending, castleModelPath]() { loadModel(castleModelPath, castleMeshes); modelsPending--; });
+    }
+    else {
+        loadModel(houseModelPath, meshes);
+        loadModel(castleModelPath, castleMeshes);
+    }
 
     // Skybox texture loading
-    std::vector<std::string> faces = {
-        R"(..\assets\skybox\nx.png)",
-        R"(..\assets\skybox\px.png)",
-        R"(..\assets\skybox\ny.png)",
-        R"(..\assets\skybox\py.png)",
-        R"(..\assets\skybox\nz.png)",
-        R"(..\assets\skybox\pz.png)"
-    };
-    unsigned int cubemapTexture = loadCubemap(faces);
+    startup.phase("skybox");
+    CubemapImages skyboxImages;
+    unsigned int cubemapTexture = 0;
+    unsigned int placeholderCubemap = 0;
+    if (asyncLoading) {
+        decodeCubemap(faces, skyboxImages);
+        placeholderCubemap = createPlaceholderCubemap(glm::vec3(0.5f)); // Fog colour
+    }
+    else {
+        cubemapTexture = loadCubemap(faces);
+    }
 
     // Set up road and grass VAOs and VBOs
+    startup.phase("vertex buffers");
     GLuint roadVAO, roadVBO;
     glGenVertexArrays(1, &roadVAO);
     glGenBuffers(1, &roadVBO);
@@ -651,6 +5672,15 @@ int main() {
     glEnableVertexAttribArray(1);
     glBindVertexArray(0);
 
+    // Wheat stalk offsets are built once and drawn with a single instanced call
+    float wheatOffset = 40.0f;
+    std::vector<glm::vec3> wheatOffsets = buildWheatGridOffsets(wheatOffset);
+    GLuint wheatInstanceVBO = createInstanceBuffer(wheatVAO, wheatOffsets);
+    std::vector<InstanceChunk> wheatChunks = buildInstanceChunks(wheatOffsets, computeVertexBounds(wheatVertices, 4, 5), 8 * 41); // 8 columns per chunk
+
+    // Non-instanced VAOs leave attribute 2 disabled, so they read this constant (no offset)
+    glVertexAttrib3f(2, 0.0f, 0.0f, 0.0f);
+
     GLuint treeVAO, treeVBO;
     glGenVertexArrays(1, &treeVAO);
     glGenBuffers(1, &treeVBO);
@@ -667,14 +5697,128 @@ int main() {
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
+    // Local-space bounds used by the culling pass
+    startup.phase("scene setup");
+    AABB roadBounds = computeVertexBounds(roadVertices, 4, 5);
+    AABB grassBounds = computeVertexBounds(grassVertices, 4, 5);
+    AABB treeBounds = computeVertexBounds(treeVertices, 4, 5);
+    Culler culler;
+    RenderQueue renderQueue;
+
+    // Static scene layout. World matrices are computed once by the first update and then reused every frame.
+    SceneGraph scene;
+    int roadNode = scene.addNode(glm::vec3(0.0f, 0.05f, 0.0f), rotationY(-270.0f), glm::vec3(1.0f), roadBounds);
+    int grassNode = scene.addNode(glm::vec3(0.0f, 0.0f, 0.0f), rotationY(-270.0f), glm::vec3(1.0f), grassBounds);
+    int houseNode1 = scene.addNode(glm::vec3(5.0f, 0.0f, 15.0f), rotationY(270.0f), glm::vec3(0.5f), AABB());
+    int houseNode2 = scene.addNode(glm::vec3(8.0f, 0.0f, -30.0f), rotationY(0.0f), glm::vec3(0.5f), AABB());
+    int castleNode = scene.addNode(glm::vec3(35.0f, 0.0f, 0.0f), rotationY(0.0f), glm::vec3(1.20f), AABB());
+
+    // Houses and castle share one set of buffers and are drawn with one multi-draw per texture.
+    // Built once the models are loaded (right away, or once the async loads have finished).
+    StaticBatch staticBatch;
+    staticBatch.setReleaseCpuData(!keepCpuData);
+    bool multiDrawIndirect = GLEW_VERSION_4_3 || (GLEW_VERSION_4_2 && GLEW_ARB_multi_draw_indirect);
+    auto buildStaticBatch = [&]() {
+        scene.setLocalBounds(houseNode1, computeModelBounds(meshes));
+        scene.setLocalBounds(houseNode2, computeModelBounds(meshes));
+        scene.setLocalBounds(castleNode, computeModelBounds(castleMeshes));
+        int houseGeometry = staticBatch.addModel(meshes, houseNode1, GPU_PASS_HOUSES);
+        staticBatch.addModelInstance(houseGeometry, (int)meshes.size(), houseNode2, GPU_PASS_HOUSES);
+        staticBatch.addModel(castleMeshes, castleNode, GPU_PASS_CASTLE);
+
+        // The batch holds its own copy of the geometry now; the meshes only keep bounds and materials
+        if (!keepCpuData) {
+            for (auto& mesh : meshes) mesh.releaseGeometry();
+            for (auto& mesh : castleMeshes) mesh.releaseGeometry();
+        }
+    };
+    // CPU memory still held for model geometry
+    auto printMemoryReport = [&]() {
+        std::cout << "Memory: house " << residentBytes(meshes) / 1024 << " KB, castle " << residentBytes(castleMeshes) / 1024
+            << " KB, static batch " << staticBatch.residentCpuBytes() / 1024 << " KB resident on the CPU" << std::endl;
+    };
+    if (!asyncLoading) {
+        startup.phase("build static batch");
+        buildStaticBatch();
+        // Every texture (including the models' materials) is registered by now; pack them into arrays
+        startup.phase("texture arrays");
+        textureLibrary.build(workerPool);
+        startup.phase("upload static batch");
+        staticBatch.upload(multiDrawIndirect, vertexFormat);
+        std::cout << "Static batch: " << (multiDrawIndirect ? "multi-draw indirect" : "per-draw fallback") << std::endl;
+        printMemoryReport();
+    }
+    bool batchQueued = !asyncLoading;   // Async: static batch and texture arrays handed to the streamer
+    bool skyboxQueued = !asyncLoading;  // Async: skybox faces handed to the streamer
+    bool loadingReported = !asyncLoading;
+    bool memoryReported = !asyncLoading;
+    bool firstFrame = true;
+
+    // Trees are scaled by 4 and flipped along y
+    std::vector<glm::vec3> treePositions = {
+        glm::vec3(0.0f, 4.0f, -30.0f),
+        glm::vec3(15.0f, 4.0f, -27.0f),
+        glm::vec3(5.0f, 4.0f, -25.0f),
+        glm::vec3(-11.0f, 4.0f, -25.0f),
+        glm::vec3(-5.0f, 4.0f, -20.0f),
+        glm::vec3(15.0f, 4.0f, -20.0f),
+        glm::vec3(20.0f, 4.0f, -15.0f),
+        glm::vec3(-10.0f, 4.0f, -14.0f)
+    };
+    std::vector<int> treeNodes;
+    for (const auto& position : treePositions) {
+        treeNodes.push_back(scene.addNode(position, rotationY(0.0f), glm::vec3(4.0f, -4.0f, 4.0f), treeBounds));
+    }
 
 
-    while (!glfwWindowShouldClose(window)) {
+    startup.phase("first frame");
+    while (!glfwWindowShouldClose(window) && !benchmark.finished() && !(exitAfterFirstFrame && !firstFrame)) {
+        PROFILE_ZONE("frame");
         float currentFrame = glfwGetTime();
         deltaTime = currentFrame - lastFrame;
         lastFrame = currentFrame;
 
-        processInput(window);
+        benchmark.beginFrame(loadingReported);
+        if (benchmark.enabled()) {
+            benchmarkCamera(benchmark.recordedFrames, benchmark.frameCount);
+        }
+        else {
+            processInput(window);
+        }
+        benchmark.mark(PHASE_INPUT);
+
+        // Async loading: hand finished CPU-side work to the streamer, then spend this frame's upload budget
+        if (!batchQueued && modelsPending == 0 && textureLibrary.decoded()) {
+            buildStaticBatch();
+            textureLibrary.buildStreamed(streamer);
+            staticBatch.upload(multiDrawIndirect, vertexFormat, &streamer);
+            batchQueued = true;
+        }
+        if (!skyboxQueued && skyboxImages.decoded()) {
+            cubemapTexture = createCubemap(skyboxImages, &streamer);
+            skyboxQueued = true;
+        }
+        streamer.update();
+        if (!loadingReported && batchQueued && skyboxQueued && streamer.idle()) {
+            std::cout << "Async loading: finished after " << glfwGetTime() << " s (" << streamer.bytesUploaded / 1024 << " KB streamed)" << std::endl;
+            loadingReported = true;
+        }
+        if (asyncLoading && staticBatch.isReady() && !memoryReported) {
+            printMemoryReport(); // After the batch has released its streamed arrays
+            memoryReported = true;
+        }
+        benchmark.mark(PHASE_STREAMING);
+        const Material roadMaterial = textureLibrary.material(roadTexture);
+        const Material grassMaterial = textureLibrary.material(grassTexture);
+        const Material wheatMaterial = textureLibrary.material(wheatTexture);
+        const Material treeMaterial = textureLibrary.material(treeTexture);
+
+        // Bring cached world transforms up to date (no work while nothing moves), then build the frustum
+        scene.update();
+        staticBatch.update(scene);
+        culler.beginFrame(projection * view);
+        benchmark.mark(PHASE_CULLING);
+        gpuTimer.beginFrame();
 
         // Enable depth test for regular objects
         glEnable(GL_DEPTH_TEST);
@@ -683,133 +5827,152 @@ int main() {
         glClearColor(0.2f, 0.3f, 0.3f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-        glUseProgram(shaderProgram);
-
-        glUniform3fv(glGetUniformLocation(shaderProgram, "cameraPos"), 1, glm::value_ptr(cameraPos)); // Camera position
-        glUniform1f(glGetUniformLocation(shaderProgram, "fogStart"), 30.0f);  // Fog start distance
-        glUniform1f(glGetUniformLocation(shaderProgram, "fogEnd"), 5.0f);    // Fog end distance
-        glUniform4fv(glGetUniformLocation(shaderProgram, "fogColor"), 1, glm::value_ptr(glm::vec4(0.5f, 0.5f, 0.5f, 1.0f))); // Light gray fog color
-
-        GLuint modelLoc = glGetUniformLocation(shaderProgram, "model");
-        GLuint viewLoc = glGetUniformLocation(shaderProgram, "view");
-        GLuint projectionLoc = glGetUniformLocation(shaderProgram, "projection");
-
-        glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-        glUniformMatrix4fv(projectionLoc, 1, GL_FALSE, glm::value_ptr(projection));
-
-        // Render the skybox (with depth testing but no depth writes)
-        glDepthMask(GL_FALSE);
-        glDepthFunc(GL_LEQUAL);  // Skybox should be rendered behind everything
-        glUseProgram(skyboxShaderProgram);
-
-        // Set fog parameters
-        glUniform3fv(glGetUniformLocation(skyboxShaderProgram, "cameraPos"), 1, glm::value_ptr(cameraPos));
-        glUniform1f(glGetUniformLocation(skyboxShaderProgram, "fogStart"), 50.0f);  // Fog start distance
-        glUniform1f(glGetUniformLocation(skyboxShaderProgram, "fogEnd"), 5.0f);    // Fog end distance
-        glUniform4fv(glGetUniformLocation(skyboxShaderProgram, "fogColor"), 1, glm::value_ptr(glm::vec4(0.5f, 0.5f, 0.5f, 1.0f))); // Fog color
-
-        glm::mat4 skyboxView = glm::mat4(glm::mat3(view));  // Remove translation from view matrix
-        glUniformMatrix4fv(glGetUniformLocation(skyboxShaderProgram, "view"), 1, GL_FALSE, glm::value_ptr(skyboxView));
-        glUniformMatrix4fv(glGetUniformLocation(skyboxShaderProgram, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
+        // Upload camera and fog state once for every program, at the start of this frame's ring region
+        uniformRing.beginFrame();
+        FrameData frameData;
+        frameData.view = view;
+        frameData.projection = projection;
+        frameData.cameraPos = glm::vec4(cameraPos, 1.0f); // Camera position
+        frameData.fogColor = glm::vec4(0.5f, 0.5f, 0.5f, 1.0f); // Light gray fog color
+        frameData.fogRange = glm::vec4(30.0f, 5.0f, 50.0f, 5.0f); // Scene fog start/end, skybox fog start/end
+        uniformRing.writeFrameData(frameData);
+
+        // Queue this frame's draws; the queue orders them by layer and state before anything is issued
+        renderQueue.clear(cameraPos);
+
+        // Skybox (drawn after the opaques with depth testing but no depth writes)
+        DrawCommand skyboxCmd;
+        skyboxCmd.program = &skyboxShaderProgram;
+        skyboxCmd.vao = skyboxVAO;
+        skyboxCmd.textureTarget = GL_TEXTURE_CUBE_MAP;
+        skyboxCmd.texture = skyboxQueued && skyboxImages.uploaded() ? cubemapTexture : placeholderCubemap;
+        skyboxCmd.count = 36;
+        skyboxCmd.gpuPass = GPU_PASS_SKYBOX;
+        renderQueue.submit(LAYER_SKYBOX, skyboxCmd, AABB());
+
+        // Road (centered) and grass
+        DrawCommand groundCmd;
+        groundCmd.program = &shaderProgram;
+        groundCmd.drawDataBuffer = uniformRing.id();
+        groundCmd.mode = GL_TRIANGLE_STRIP;
+        groundCmd.count = 4;
+        groundCmd.gpuPass = GPU_PASS_GROUND;
+        if (culler.isVisible(scene.worldBounds(roadNode))) {
+            groundCmd.vao = roadVAO;
+            groundCmd.texture = roadMaterial.arrayTexture;
+            groundCmd.drawDataOffset = uniformRing.writeDraw(scene.world(roadNode), roadMaterial.layer);
+            if (groundCmd.drawDataOffset >= 0) renderQueue.submit(LAYER_OPAQUE, groundCmd, scene.worldBounds(roadNode));
+        }
+        if (culler.isVisible(scene.worldBounds(grassNode))) {
+            groundCmd.vao = grassVAO;
+            groundCmd.texture = grassMaterial.arrayTexture;
+            groundCmd.drawDataOffset = uniformRing.writeDraw(scene.world(grassNode), grassMaterial.layer);
+            if (groundCmd.drawDataOffset >= 0) renderQueue.submit(LAYER_OPAQUE, groundCmd, scene.worldBounds(grassNode));
+        }
 
-        // Bind and render the skybox
-        glBindVertexArray(skyboxVAO);
-        glBindTexture(GL_TEXTURE_CUBE_MAP, cubemapTexture);
-        glDrawArrays(GL_TRIANGLES, 0, 36);
-        glBindVertexArray(0);
+        // Wheat fields (with a grid pattern, one instance per stalk, culled in column strips).
+        // Every run of visible chunks shares the one identity-transform record.
+        DrawCommand wheatCmd;
+        wheatCmd.program = &shaderProgram;
+        wheatCmd.drawDataBuffer = uniformRing.id();
+        wheatCmd.drawDataOffset = uniformRing.writeDraw(glm::mat4(1.0f), wheatMaterial.layer);
+        wheatCmd.vao = wheatVAO;
+        wheatCmd.texture = wheatMaterial.arrayTexture;
+        wheatCmd.mode = GL_TRIANGLE_STRIP;
+        wheatCmd.count = 4;
+        wheatCmd.instanceBuffer = wheatInstanceVBO;
+        wheatCmd.gpuPass = GPU_PASS_WHEAT;
+        if (wheatCmd.drawDataOffset >= 0) {
+            submitInstanceChunks(renderQueue, wheatCmd, wheatChunks, culler);
+        }
 
-        // Reset depth function to GL_LESS for rendering other objects
-        glDepthMask(GL_TRUE);
-        glDepthFunc(GL_LESS);
-        glUseProgram(shaderProgram);
+        // Houses and castle
+        // (each mesh is culled on its own; culled draws stay in the indirect buffer with zero instances)
+        staticBatch.cull(culler);
+        submitStaticBatch(renderQueue, staticBatch, staticShaderProgram);
 
-        // Render the road (centered)
-        glm::mat4 roadModel = glm::mat4(1.0f);
-        roadModel = glm::rotate(roadModel, glm::radians(-270.0f), glm::vec3(0.0f, 1.0f, 0.0f));
-        roadModel = glm::translate(roadModel, glm::vec3(0.0f, 0.05f, 0.0f));
-        glBindVertexArray(roadVAO);
-        glBindTexture(GL_TEXTURE_2D, roadTexture);
-        glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(roadModel));
-        glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+        // Trees (transparent layer; the queue sorts them back-to-front from the current camera position)
+        for (int treeNode : treeNodes) {
+            renderTree(renderQueue, treeVAO, treeMaterial, shaderProgram, uniformRing, culler, scene, treeNode);
+        }
 
-        // Render the grass
-        glm::mat4 grassModel = glm::mat4(1.0f);
-        grassModel = glm::rotate(grassModel, glm::radians(-270.0f), glm::vec3(0.0f, 1.0f, 0.0f));
-        grassModel = glm::translate(grassModel, glm::vec3(0.0f, 0.0f, 0.0f));
-        glBindVertexArray(grassVAO);
-        glBindTexture(GL_TEXTURE_2D, grassTexture);
-        glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(grassModel));
-        glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+        benchmark.mark(PHASE_QUEUE);
+        renderQueue.sort();
+        uniformRing.flush();
+        renderQueue.execute(&gpuTimer);
+        gpuTimer.endFrame();
 
-        // Render the wheat fields (with a grid pattern)
-        float wheatOffset = 40.0f;
-        glBindVertexArray(wheatVAO);
-        glBindTexture(GL_TEXTURE_2D, wheatTexture);
+        uniformRing.endFrame();
+        benchmark.mark(PHASE_SUBMIT);
 
-        // Grid of wheat
-        for (int x = -100; x <= 100; ++x) {
-            for (int z = -20; z <= 20; ++z) {
-                glm::mat4 wheatModel = glm::mat4(1.0f);
-                wheatModel = glm::translate(wheatModel, glm::vec3(x * 0.25f, 0.0f, wheatOffset + z * 0.25f));
-                glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(wheatModel));
-                glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+        // C: print how many objects the culling pass tested and skipped this frame
+        if (keyPressed(window, GLFW_KEY_C)) {
+            std::cout << "Culling: " << culler.tested << " tested, " << culler.culled << " culled" << std::endl;
+        }
+        // R: print the render queue's draw and state change counts for this frame
+        if (keyPressed(window, GLFW_KEY_R)) {
+            std::cout << "Render queue: " << renderQueue.drawCount << " draws, " << renderQueue.programChanges << " program, "
+                << renderQueue.textureChanges << " texture, " << renderQueue.vaoChanges << " VAO changes" << std::endl;
+        }
+        // M: print the CPU memory still held for model geometry
+        if (keyPressed(window, GLFW_KEY_M)) {
+            printMemoryReport();
+        }
+        // L: print the GL calls, binds and upload bytes of the last complete frame
+        if (keyPressed(window, GLFW_KEY_L)) {
+            printGLAccounting();
+        }
+        // G: print the rolling GPU time of each pass
+        if (keyPressed(window, GLFW_KEY_G)) {
+            if (gpuTimer.isEnabled()) {
+                std::cout << "GPU passes (ms, last " << GpuPassTimer::AVERAGE_FRAMES << " frames):";
+                for (int pass = 0; pass < GPU_PASS_COUNT; pass++) {
+                    std::cout << " " << gpuPassName(pass) << " " << gpuTimer.average(pass);
+                }
+                std::cout << " (" << gpuTimer.droppedFrames << " frames dropped)" << std::endl;
+            }
+            else {
+                std::cout << "GPU passes: timer queries are not supported" << std::endl;
             }
         }
 
-        // Set transformation matrices
-        glm::mat4 houseModel1 = glm::mat4(1.0f);
-        houseModel1 = glm::translate(houseModel1, glm::vec3(5.0f, 0.0f, 15.0f));
-        houseModel1 = glm::rotate(houseModel1, glm::radians(270.0f), glm::vec3(0.0f, 1.0f, 0.0f));
-        houseModel1 = glm::scale(houseModel1, glm::vec3(0.5, 0.5, 0.5));
-
-        glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(houseModel1));
-
-        for (auto& mesh : meshes) {
-            mesh.draw();
+        // Headless frames have nothing to present; wait for the GPU so the frame time covers its work
+        if (firstFrame) {
+            startup.phase("first swap");
         }
-
-        glm::mat4 houseModel2 = glm::mat4(1.0f);
-        houseModel2 = glm::translate(houseModel2, glm::vec3(8.0f, 0.0f, -30.0f));
-        houseModel2 = glm::rotate(houseModel2, glm::radians(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
-        houseModel2 = glm::scale(houseModel2, glm::vec3(0.5, 0.5, 0.5));
-
-        glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(houseModel2));
-
-        for (auto& mesh : meshes) {
-            mesh.draw();
+        {
+            PROFILE_ZONE("present");
+            if (headless) {
+                glFinish();
+            }
+            else {
+                glfwSwapBuffers(window);
+            }
+            glfwPollEvents();
         }
-
-        // Set up castle model transformation
-        glm::mat4 castleModel = glm::mat4(1.0f);
-        castleModel = glm::translate(castleModel, glm::vec3(35.0f, 0.0f, 0.0f));
-        castleModel = glm::scale(castleModel, glm::vec3(1.20, 1.20, 1.20));
-        glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(castleModel));
-        for (auto& mesh : castleMeshes) {
-            mesh.draw();
+        endGLAccountingFrame();
+        benchmark.mark(PHASE_PRESENT);
+        benchmark.endFrame();
+
+        if (firstFrame) {
+            startup.finish();
+            startup.print();
+            if (!startupReportPath.empty()) {
+                startup.writeReport(startupReportPath);
+            }
+            firstFrame = false;
         }
+    }
 
-        // Enable blending for transparent objects
-        glEnable(GL_BLEND);
-        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-        // Render trees (furthest back rendered first to not overlap and hide trees behind)
-        renderTree(treeVAO, treeTexture, modelLoc, glm::vec3(0.0f, 4.0f, -30.0f));
-        renderTree(treeVAO, treeTexture, modelLoc, glm::vec3(15.0f, 4.0f, -27.0f));
-        renderTree(treeVAO, treeTexture, modelLoc, glm::vec3(5.0f, 4.0f, -25.0f));
-        renderTree(treeVAO, treeTexture, modelLoc, glm::vec3(-11.0f, 4.0f, -25.0f));
-        renderTree(treeVAO, treeTexture, modelLoc, glm::vec3(-5.0f, 4.0f, -20.0f));
-        renderTree(treeVAO, treeTexture, modelLoc, glm::vec3(15.0f, 4.0f, -20.0f));
-        renderTree(treeVAO, treeTexture, modelLoc, glm::vec3(20.0f, 4.0f, -15.0f));
-        renderTree(treeVAO, treeTexture, modelLoc, glm::vec3(-10.0f, 4.0f, -14.0f));
-        // Disable blend
-        glDisable(GL_BLEND);
-
-        glBindTexture(GL_TEXTURE_2D, 0);
 
-        glfwSwapBuffers(window);
-        glfwPollEvents();
+    if (benchmark.enabled()) {
+        const GLubyte* renderer = glGetString(GL_RENDERER);
+        if (benchmark.writeReport(benchmarkReportPath, width, height, contextName, renderer ? (const char*)renderer : "", gpuTimer)) {
+            std::cout << "Benchmark: " << benchmark.recordedFrames << " frames, p50 " << FrameBenchmark::percentile(benchmark.frameMs, 50.0)
+                << " ms, p99 " << FrameBenchmark::percentile(benchmark.frameMs, 99.0) << " ms, report written to " << benchmarkReportPath << std::endl;
+        }
     }
 
-
     // Clean up
 
     glDeleteVertexArrays(1, &roadVAO);
@@ -818,10 +5981,28 @@ int main() {
     glDeleteBuffers(1, &treeVBO);
     glDeleteVertexArrays(1, &wheatVAO);
     glDeleteBuffers(1, &wheatVBO);
+    glDeleteBuffers(1, &wheatInstanceVBO);
     glDeleteVertexArrays(1, &grassVAO);
     glDeleteBuffers(1, &grassVBO);
-    glDeleteProgram(shaderProgram);
-    glDeleteProgram(skyboxShaderProgram);
+    workerPool.stop(); // Finish any load still running before its destination goes away
+    finishTrace(tracePath);
+    uniformRing.destroy();
+    releaseMaterials(meshes);
+    releaseMaterials(castleMeshes);
+    for (int material : { roadTexture, grassTexture, wheatTexture, treeTexture }) {
+        textureLibrary.release(material);
+    }
+    gpuTimer.destroy();
+    staticBatch.destroy();
+    textureLibrary.destroy();
+    streamer.destroy();
+    glDeleteTextures(1, &cubemapTexture);
+    glDeleteTextures(1, &placeholderCubemap);
+    glDeleteProgram(shaderProgram.id());
+    glDeleteProgram(skyboxShaderProgram.id());
+    glDeleteProgram(staticShaderProgram.id());
+    glDeleteRenderbuffers(2, offscreenRenderbuffers);
+    glDeleteFramebuffers(1, &offscreenFBO);
 
     glfwTerminate();
     return 0;